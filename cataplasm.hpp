@@ -1,13 +1,75 @@
 //===[  CATAPLASM v0.2.1 – a small test framework ]===========================//
 #pragma once
+#if defined(CATAPLASM_MAIN) && !defined(CATAPLASM_IMPLEMENTATION)
+#define CATAPLASM_IMPLEMENTATION
+#endif
+#if defined(CATAPLASM_IMPLEMENTATION) && !defined(CATAPLASM_FULL)
+#define CATAPLASM_FULL
+#endif
+
+//  The interface, seen by every test TU
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <initializer_list>
+#include <iosfwd>
+#include <iterator>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if !defined(__GNUC__) && !defined(__clang__)
+#include <atomic>
+#endif
+
+//  The referee and reporters, with CATAPLASM_FULL
+#ifdef CATAPLASM_FULL
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
-#include <exception>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
 #include <sstream>
-#include <string>
-#include <vector>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CATAPLASM_POSIX
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#define CATAPLASM_PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__)
+#define CATAPLASM_ELF_BUILD_ID
+#include <link.h>
+#endif
+#endif
 
 //  Suppress warnings for cataplasm::ExprShunt
 #ifdef __clang__
@@ -35,33 +97,87 @@
   cataplasm::BlockLoader                                                       \
       LINE_UID(TEST_CASE_LOADER)(cataplasm::NodeType::Block,                   \
                                  cataplasm::Status::Null, &_TEST_CASE_FN,      \
-                                 cataplasm::NameTags{__VA_ARGS__}, __LINE__);  \
+                                 cataplasm::NameTags{__VA_ARGS__}, __LINE__,   \
+                                 __FILE__);                                    \
   }                                                                            \
   static void _TEST_CASE_FN()
 
+#define TEST_CASE_FIXTURE(fixture, ...)                                        \
+  namespace {                                                                  \
+  struct LINE_UID(TEST_CASE_FIXTURE) : fixture {                               \
+    void cataplasm_body();                                                     \
+  };                                                                           \
+  }                                                                            \
+  static void _TEST_CASE_FN() {                                                \
+    cataplasm::copy_fixture<LINE_UID(TEST_CASE_FIXTURE)>().cataplasm_body();   \
+  }                                                                            \
+  namespace {                                                                  \
+  cataplasm::BlockLoader                                                       \
+      LINE_UID(TEST_CASE_LOADER)(cataplasm::NodeType::Block,                   \
+                                 cataplasm::Status::Null, &_TEST_CASE_FN,      \
+                                 cataplasm::NameTags{__VA_ARGS__}, __LINE__,   \
+                                 __FILE__);                                    \
+  }                                                                            \
+  void LINE_UID(TEST_CASE_FIXTURE)::cataplasm_body()
+
 #define SECTION(...)                                                           \
   if (cataplasm::SectionLoader scope = cataplasm::SectionLoader(               \
           __LINE__, cataplasm::NameTags{__VA_ARGS__}))
 
+#define BENCHMARK(name)                                                        \
+  for (cataplasm::BenchmarkRunner LINE_UID(BENCHMARK_RUNNER){__LINE__, name};  \
+       LINE_UID(BENCHMARK_RUNNER).next();)
+
+//----[ Generators ]------------------------------------------------------------
+#define GENERATE(...)                                                          \
+  cataplasm::generate(__LINE__, "GENERATE(" #__VA_ARGS__ ")", {__VA_ARGS__})
+
+#define GENERATE_RANGE(first, last)                                            \
+  cataplasm::generate_from(__LINE__,                                           \
+                           "GENERATE_RANGE(" #first ", " #last ")",            \
+                           cataplasm::make_range(first, last))
+
+#define GENERATE_FROM(values)                                                  \
+  cataplasm::generate_from(__LINE__, "GENERATE_FROM(" #values ")", values)
+
+//----[ Properties ]------------------------------------------------------------
+#define _PROPERTY_FN LINE_UID(PROPERTY)
+
+// The first argument after the parameters is only evaluated if a string.
+#define _PROPERTY_TAGS(first, ...)                                             \
+  cataplasm::property_tags<decltype(first)>([] { return first; })
+
+#define PROPERTY(name, params, ...)                                            \
+  static void _PROPERTY_FN params;                                             \
+  static void _TEST_CASE_FN() {                                                \
+    cataplasm::check_property(&_PROPERTY_FN, #params, __VA_ARGS__);            \
+  }                                                                            \
+  namespace {                                                                  \
+  cataplasm::BlockLoader LINE_UID(TEST_CASE_LOADER)(                           \
+      cataplasm::NodeType::Block, cataplasm::Status::Null, &_TEST_CASE_FN,     \
+      cataplasm::NameTags{name, _PROPERTY_TAGS(__VA_ARGS__, ~)}, __LINE__,     \
+      __FILE__);                                                               \
+  }                                                                            \
+  static void _PROPERTY_FN params
+
 //----[ Basic tests ]-----------------------------------------------------------
 #define _NODE(expression, type, pass, fail, halt_on_fail)                      \
   try {                                                                        \
-    cataplasm::ExprResult res = (cataplasm::ExprShunt() << expression);        \
-    auto status = res.status ? pass : fail;                                    \
-    cataplasm::g_TestReferee().push_node(type, status, res.expr, __LINE__,     \
-                                         #expression);                         \
+    auto status = cataplasm::push_result(                                      \
+        type, pass, fail, (cataplasm::ExprShunt() << expression), __LINE__,    \
+        #expression);                                                          \
     if (halt_on_fail && (status == cataplasm::Status::Fail)) {                 \
       return;                                                                  \
     }                                                                          \
   } catch (...) {                                                              \
-    cataplasm::g_TestReferee().push_exception(                                 \
-        std::current_exception(), cataplasm::NodeType::ThrowsUnexpected,       \
-        cataplasm::Status::Fail, #expression, __LINE__);                       \
+    cataplasm::push_exception(std::current_exception(),                        \
+                              cataplasm::NodeType::ThrowsUnexpected,           \
+                              cataplasm::Status::Fail, #expression, __LINE__); \
     return;                                                                    \
   }
 #define _IF_NODE(expression, type, pass, fail, halt_on_fail)                   \
   _NODE(expression, type, pass, fail, halt_on_fail)                            \
-  if (pass == cataplasm::g_TestReferee().lastNode().status)
+  if (pass == cataplasm::last_status())
 
 #define ENSURE(...)                                                            \
   _NODE(__VA_ARGS__, cataplasm::NodeType::Ensure, cataplasm::Status::Succeed,  \
@@ -106,10 +222,46 @@
 
 #define ENSURE_PTR(ptr) ENSURE(ptr != nullptr)
 
+//----[ Approximate tests ]-----------------------------------------------------
+#define _CLOSE_NODE(check, source, type, halt_on_fail)                         \
+  try {                                                                        \
+    auto status = cataplasm::push_result(type, cataplasm::Status::Succeed,     \
+                                         cataplasm::Status::Fail, check,       \
+                                         __LINE__, source);                    \
+    if (halt_on_fail && (status == cataplasm::Status::Fail)) {                 \
+      return;                                                                  \
+    }                                                                          \
+  } catch (...) {                                                              \
+    cataplasm::push_exception(std::current_exception(),                        \
+                              cataplasm::NodeType::ThrowsUnexpected,           \
+                              cataplasm::Status::Fail, source, __LINE__);      \
+    return;                                                                    \
+  }
+
+#define ENSURE_APPROX(lhs, rhs, rel, abs)                                      \
+  _CLOSE_NODE(cataplasm::approx(lhs, rhs, rel, abs),                           \
+              #lhs ", " #rhs ", " #rel ", " #abs,                              \
+              cataplasm::NodeType::EnsureApprox, true)
+
+#define VERIFY_APPROX(lhs, rhs, rel, abs)                                      \
+  _CLOSE_NODE(cataplasm::approx(lhs, rhs, rel, abs),                           \
+              #lhs ", " #rhs ", " #rel ", " #abs,                              \
+              cataplasm::NodeType::VerifyApprox, false)
+
+#define ENSURE_ALL_CLOSE(lhs, rhs, rel, abs)                                   \
+  _CLOSE_NODE(cataplasm::all_close(lhs, rhs, rel, abs),                        \
+              #lhs ", " #rhs ", " #rel ", " #abs,                              \
+              cataplasm::NodeType::EnsureAllClose, true)
+
+#define VERIFY_ALL_CLOSE(lhs, rhs, rel, abs)                                   \
+  _CLOSE_NODE(cataplasm::all_close(lhs, rhs, rel, abs),                        \
+              #lhs ", " #rhs ", " #rel ", " #abs,                              \
+              cataplasm::NodeType::VerifyAllClose, false)
+
 //----[ Exception-handling tests ]----------------------------------------------
 #define _THROW_NODE(expr, node, result)                                        \
-  cataplasm::g_TestReferee().push_exception(std::current_exception(), node,    \
-                                            result, expr, __LINE__)
+  cataplasm::push_exception(std::current_exception(), node, result, expr,      \
+                            __LINE__)
 
 #define THROWS(...)                                                            \
   try {                                                                        \
@@ -128,7 +280,7 @@
     _THROW_NODE(#__VA_ARGS__, cataplasm::NodeType::ThrowsUnexpected,           \
                 cataplasm::Status::Fail);                                      \
   }                                                                            \
-  if (cataplasm::g_TestReferee().lastNode().line != __LINE__)                  \
+  if (cataplasm::last_line() != __LINE__)                                      \
   _THROW_NODE(#__VA_ARGS__, cataplasm::NodeType::NoThrow,                      \
               cataplasm::Status::Succeed)
 
@@ -148,47 +300,49 @@ struct ThrowsAsFailure : public std::exception {};
                 cataplasm::Status::Fail);                                      \
   }
 
+//----[ Allocation tests ]----------------------------------------------------
+#define ENSURE_NO_ALLOC(...)                                                   \
+  try {                                                                        \
+    cataplasm::AllocationScope LINE_UID(ALLOCATIONS);                          \
+    (void)(__VA_ARGS__);                                                       \
+    if (cataplasm::push_allocations(cataplasm::NodeType::EnsureNoAlloc,        \
+                                    LINE_UID(ALLOCATIONS).finish(), 0,         \
+                                    __LINE__, #__VA_ARGS__) ==                 \
+        cataplasm::Status::Fail) {                                             \
+      return;                                                                  \
+    }                                                                          \
+  } catch (...) {                                                              \
+    _THROW_NODE(#__VA_ARGS__, cataplasm::NodeType::ThrowsUnexpected,           \
+                cataplasm::Status::Fail);                                      \
+    return;                                                                    \
+  }
+
+#define ENSURE_PEAK_BYTES_LE(limit)                                            \
+  for (cataplasm::PeakBytesCheck LINE_UID(PEAK_BYTES){__LINE__, limit,         \
+                                                      #limit};                 \
+       LINE_UID(PEAK_BYTES).next();)
+
 //----[ Special tests & Messages ]----------------------------------------------
 #define FAIL(...)                                                              \
-  cataplasm::g_TestReferee().push_node(cataplasm::NodeType::Fail,              \
-                                       cataplasm::Status::Fail, #__VA_ARGS__,  \
-                                       __LINE__)
+  cataplasm::push_node(cataplasm::NodeType::Fail, cataplasm::Status::Fail,     \
+                       #__VA_ARGS__, __LINE__)
 
 #define PASS(...)                                                              \
-  cataplasm::g_TestReferee().push_node(cataplasm::NodeType::Pass,              \
-                                       cataplasm::Status::Succeed,             \
-                                       #__VA_ARGS__, __LINE__)
+  cataplasm::push_node(cataplasm::NodeType::Pass, cataplasm::Status::Succeed,  \
+                       #__VA_ARGS__, __LINE__)
 
 #define NOTICE(...)                                                            \
-  cataplasm::g_TestReferee().push_node(cataplasm::NodeType::Notice,            \
-                                       cataplasm::Status::Null, __VA_ARGS__,   \
-                                       __LINE__)
+  cataplasm::push_message(cataplasm::NodeType::Notice, __VA_ARGS__, __LINE__)
 
 #define WARN(...)                                                              \
-  cataplasm::g_TestReferee().push_node(cataplasm::NodeType::Warn,              \
-                                       cataplasm::Status::Null, __VA_ARGS__,   \
-                                       __LINE__)
+  cataplasm::push_message(cataplasm::NodeType::Warn, __VA_ARGS__, __LINE__)
 
 namespace cataplasm {
 //----[ Typedefs ]--------------------------------------------------------------
 using payload_fn = void (*)(); //<! Function pointer to test case.
 
-//----[ CLI colours ]-----------------------------------------------------------
-enum class CLIAttr {
-  Reset,
-  Bold,
-  Red,
-  Green,
-  Yellow,
-  Blue,
-};
-
-static const char *CLIAttrCodes[] = {
-    "\33[0m", "\33[1m", "\33[31m", "\33[32m", "\33[33m", "\33[34m",
-};
-
 //----[ NodeType ]--------------------------------------------------------------
-enum class NodeType {
+enum class NodeType : uint8_t {
   Ensure,
   Verify,
   Forbid,
@@ -196,8 +350,17 @@ enum class NodeType {
   Throws,
   ThrowsAs,
   NoThrow,
+  EnsureNoAlloc,
+  EnsurePeakBytes,
+  EnsureApprox,
+  VerifyApprox,
+  EnsureAllClose,
+  VerifyAllClose,
   ThrowsUnexpected,
   ThrowsOutOfNode,
+  Crash,
+  Timeout,
+  Benchmark,
   Fail,
   Pass,
   Block,
@@ -211,66 +374,210 @@ inline bool is_container(NodeType type) {
   return (type == NodeType::Block || type == NodeType::Section);
 }
 
+//! Return true if the given NodeType is counted as a test.
+inline bool is_test_type(NodeType type) {
+  return type <= NodeType::Pass && type != NodeType::Benchmark;
+}
+
 static constexpr const char *NodeTypeName[]{
-    "ENSURE",   "VERIFY",   "FORBID",           "REJECT",          "THROWS",
-    "THOWS_AS", "NO_THROW", "ThrowsUnexpected", "ThrowsOutOfNode", "FAIL",
-    "PASS",     "Block",    "Section",          "NOTICE",          "WARN",
+    "ENSURE",           "VERIFY",           "FORBID",
+    "REJECT",           "THROWS",           "THOWS_AS",
+    "NO_THROW",         "ENSURE_NO_ALLOC",  "ENSURE_PEAK_BYTES_LE",
+    "ENSURE_APPROX",    "VERIFY_APPROX",    "ENSURE_ALL_CLOSE",
+    "VERIFY_ALL_CLOSE", "ThrowsUnexpected", "ThrowsOutOfNode",
+    "Crash",            "Timeout",          "BENCHMARK",
+    "FAIL",             "PASS",             "Block",
+    "Section",          "NOTICE",           "WARN",
 };
 
-enum class Status { Fail, Succeed, Null };
+enum class Status : uint8_t { Fail, Succeed, Null };
 
+/** The result of a test expression. The string representation of the
+ *  expression is built on demand by `expand()`, so assertions which pass
+ *  never pay for formatting their operands.
+ */
 struct ExprResult {
-  bool status;
-  std::string expr;
+  using expand_fn = std::string (*)(const void *, const void *, const char *);
+
+  ExprResult(bool status, std::string expr = "")
+      : status{status}, expr{std::move(expr)}, expand_{nullptr}, lhs_{nullptr},
+        rhs_{nullptr}, op_{nullptr} {}
+  ExprResult(bool status, expand_fn fn, const void *lhs,
+             const void *rhs = nullptr, const char *op = nullptr)
+      : status{status}, expr{}, expand_{fn}, lhs_{lhs}, rhs_{rhs}, op_{op} {}
+
+  /** Build the string representation of the expression. The operands are
+   *  only referenced, so this must be called before the end of the
+   *  full-expression which produced the result.
+   */
+  std::string expand() const {
+    return expand_ ? expand_(lhs_, rhs_, op_) : expr;
+  }
+
+  bool status;      //<! Whether or not the expression evaluated true.
+  std::string expr; //<! Message, for results not built by a TestExpression.
+private:
+  expand_fn expand_; //<! Formatter for the operands, if any.
+  const void *lhs_;  //<! Left-hand operand.
+  const void *rhs_;  //<! Right-hand operand, for binary expressions.
+  const char *op_;   //<! Operator, for binary expressions.
 };
 
-template <typename T> struct TestExpression {
-  template <typename StreamType, typename ValueType> class to_string_able {
-    template <typename SomeStream, typename SomeValue>
-    static constexpr auto test(int)
-        -> decltype(std::declval<SomeStream &>() << std::declval<SomeValue>(),
-                    std::true_type());
-    template <typename, typename>
-    static constexpr auto test(...) -> std::false_type;
+//----[ Value strings ]---------------------------------------------------------
+//! Writes the value at a pointer to a stream.
+using stream_fn = void (*)(std::ostream &, const void *);
 
-  public:
-    using value = decltype(test<StreamType, ValueType>(0));
-  };
+template <typename T> void stream_value(std::ostream &os, const void *value) {
+  os << *static_cast<const T *>(value);
+}
+
+/** Formatters which need a std::ostringstream; these are defined with the
+ *  implementation, so test TUs need only see <iosfwd>.
+ */
+std::string stream_string(stream_fn fn, const void *value);
+std::string number_string(double value);
+std::string number_string(long double value);
+std::string pointer_string(const void *value);
+
+//! Whether a value of type T can be written to a std::ostream.
+template <typename T> class is_streamable {
   template <typename U>
-  using select = typename to_string_able<std::ostringstream, U>::value;
+  static auto test(int)
+      -> decltype(std::declval<std::ostream &>() << std::declval<const U &>(),
+                  std::true_type());
+  template <typename> static auto test(...) -> std::false_type;
+
+public:
+  using type = decltype(test<T>(0));
+};
+
+//! How value_string() formats a value of a type.
+enum class ValueKind {
+  Character,
+  Signed,
+  Unsigned,
+  Real,
+  Text,
+  Pointer,
+  Streamed,
+  Enumerator,
+  Unknown,
+};
+
+/** The ValueKind of a type. Only classes and enumerations are written with
+ *  their operator<<, which is all that can be found without <ostream>.
+ */
+template <typename T> struct value_kind {
+  using pointer = typename std::decay<T>::type;
+  using pointee = typename std::remove_cv<
+      typename std::remove_pointer<pointer>::type>::type;
+
+  static constexpr ValueKind value =
+      std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+              std::is_same<T, unsigned char>::value
+          ? ValueKind::Character
+      : std::is_integral<T>::value
+          ? (std::is_signed<T>::value ? ValueKind::Signed : ValueKind::Unsigned)
+      : std::is_floating_point<T>::value ? ValueKind::Real
+      : std::is_pointer<pointer>::value && std::is_same<pointee, char>::value
+          ? ValueKind::Text
+      : std::is_pointer<pointer>::value && !std::is_function<pointee>::value
+          ? ValueKind::Pointer
+      : (std::is_class<T>::value || std::is_enum<T>::value) &&
+              is_streamable<T>::type::value
+          ? ValueKind::Streamed
+      : std::is_enum<T>::value && std::is_convertible<T, long long>::value
+          ? ValueKind::Enumerator
+          : ValueKind::Unknown;
+};
+
+template <ValueKind kind>
+using ValueTag = std::integral_constant<ValueKind, kind>;
+
+inline std::string value_string(bool value) { return value ? "true" : "false"; }
+inline std::string value_string(const char *value) {
+  return value ? value : "";
+}
+inline std::string value_string(const std::string &value) { return value; }
+inline std::string value_string(std::nullptr_t) { return "nullptr"; }
+
+template <typename T>
+std::string format_value(const T &value, ValueTag<ValueKind::Character>) {
+  return std::string(1, static_cast<char>(value));
+}
+
+template <typename T>
+std::string format_value(const T &value, ValueTag<ValueKind::Signed>) {
+  return std::to_string(static_cast<long long>(value));
+}
+
+template <typename T>
+std::string format_value(const T &value, ValueTag<ValueKind::Unsigned>) {
+  return std::to_string(static_cast<unsigned long long>(value));
+}
+
+template <typename T>
+std::string format_value(const T &value, ValueTag<ValueKind::Real>) {
+  using real = typename std::conditional<std::is_same<T, long double>::value,
+                                         long double, double>::type;
+  return number_string(static_cast<real>(value));
+}
+
+template <typename T>
+std::string format_value(const T &value, ValueTag<ValueKind::Text>) {
+  return value_string(static_cast<const char *>(value));
+}
+
+template <typename T>
+std::string format_value(const T &value, ValueTag<ValueKind::Pointer>) {
+  return pointer_string(static_cast<const void *>(value));
+}
+
+template <typename T>
+std::string format_value(const T &value, ValueTag<ValueKind::Streamed>) {
+  return stream_string(&stream_value<T>, &value);
+}
+
+template <typename T>
+std::string format_value(const T &value, ValueTag<ValueKind::Enumerator>) {
+  return std::to_string(static_cast<long long>(value));
+}
+
+template <typename T>
+std::string format_value(const T &, ValueTag<ValueKind::Unknown>) {
+  return "[unknown]";
+}
+
+//! Format an operand or generated value, if it can be printed.
+template <typename T> std::string value_string(const T &value) {
+  return format_value(value, ValueTag<value_kind<T>::value>());
+}
+
+template <typename T> struct TestExpression {
+  using value_type = typename std::remove_reference<T>::type;
 
   TestExpression(T lhs) : lhs_mote_{lhs} {}
 
   operator ExprResult() const {
-    return ExprResult{!!(lhs_mote_), str(lhs_mote_)};
+    return ExprResult{!!(lhs_mote_), &expand_unary, &lhs_mote_};
   }
 
 #define def_op(which)                                                          \
   template <typename U> ExprResult operator which(const U &u) {                \
-    return {(lhs_mote_ which u), str(lhs_mote_) + " " #which " " + str(u)};    \
+    return {(lhs_mote_ which u), &expand_binary<U>, &lhs_mote_, &u, #which};   \
   }
 
   def_op(==) def_op(!=) def_op(<) def_op(>) def_op(<=) def_op(>=) private
-      : template <typename U>
-        std::string str(const U &u) {
-    return _str(u, select<U>());
-  }
-
-  template <size_t N> std::string str(const char (&u)[N]) const {
-    return std::string(u);
-  }
-
-  std::string str(const std::string &s) const { return s; }
-  std::string str(const bool &b) const { return b ? "true" : "false"; }
-
-  template <typename U> std::string _str(const U &u, std::true_type) const {
-    std::ostringstream os;
-    os << u;
-    return os.str();
+      : static std::string
+        expand_unary(const void *lhs, const void *, const char *) {
+    return value_string(*static_cast<const value_type *>(lhs));
   }
 
-  template <typename U> std::string _str(const U &, std::false_type) const {
-    return "[unknown]";
+  template <typename U>
+  static std::string expand_binary(const void *lhs, const void *rhs,
+                                   const char *op) {
+    return value_string(*static_cast<const value_type *>(lhs)) + " " + op +
+           " " + value_string(*static_cast<const U *>(rhs));
   }
 
   const T lhs_mote_;
@@ -282,488 +589,4933 @@ struct ExprShunt {
   }
 };
 
-//----[ NameTags ]--------------------------------------------------------------
-struct NameTags {
-  NameTags(const char *name = "Anonymous Node", const char *tags = "")
-      : name{name}, tags{tags} {}
-  const char *name; //<! Name of the block.
-  const char *tags; //<! Tags for the block.
-};
+//----[ Approximate comparisons ]-----------------------------------------------
+/** The type values of types A and B are compared in: their common type if it
+ *  is floating-point, such as float for two floats, or else double.
+ */
+template <typename A, typename B>
+using close_type = typename std::conditional<
+    std::is_floating_point<typename std::common_type<A, B>::type>::value,
+    typename std::common_type<A, B>::type, double>::type;
 
-//----[ Stream manipulators ]---------------------------------------------------
-//! Output colour codes from CLIAttr enums.
-inline std::ostream &operator<<(std::ostream &os, CLIAttr code) {
-  return os << CLIAttrCodes[static_cast<uint8_t>(code)];
-}
+//! Whether a value is neither infinite nor NaN, without needing <cmath>.
+template <typename T> bool is_finite(T value) { return value - value == 0; }
 
-inline std::ostream &operator<<(std::ostream &os, NodeType type) {
-  return os << NodeTypeName[static_cast<size_t>(type)];
+/** The difference between two values, or 0 if they are equal. It is NaN if
+ *  either is NaN, and infinite if they are unequal and either is infinite.
+ */
+template <typename T> T close_error(T a, T b) {
+  return a == b ? T(0) : a > b ? a - b : b - a;
 }
 
-//! Output status messages from Status enums.
-inline std::ostream &operator<<(std::ostream &os, Status status) {
-  switch (status) {
-  case Status::Succeed:
-    return os << CLIAttr::Green << "[ PASS ] " << CLIAttr::Reset;
-  case Status::Fail:
-    return os << CLIAttr::Red << "[ FAIL ] " << CLIAttr::Reset;
-  case Status::Null:
-  default:
-    return os;
-  }
+//! The greater of `abs` and `rel` times the larger magnitude of `a` and `b`.
+template <typename T> T close_tolerance(T a, T b, T rel, T abs) {
+  const T mag_a = a < 0 ? -a : a, mag_b = b < 0 ? -b : b;
+  const T scaled = rel * (mag_a > mag_b ? mag_a : mag_b);
+  return abs > scaled ? abs : scaled;
 }
 
-//----[ Misc functions ]--------------------------------------------------------
-/**
- * @brief Split a string on `STRING_DELIMITER` and insert the resulting
- * strings into the passed vector.
- */
-static void split_string(std::string string, std::vector<std::string> &vec) {
-  std::string::size_type pos = 0, last = 0;
-  do {
-    pos = string.find_first_of(';', last);
-    if (pos == std::string::npos) {
-      pos = string.length();
-      if (pos != last)
-        vec.emplace_back(string.data() + last, pos - last);
-      break;
-    } else {
-      if (pos != last)
-        vec.emplace_back(string.data() + last, pos - last);
-    }
-    last = pos + 1;
-    while (string[last] == ' ')
-      ++last;
-  } while (pos != std::string::npos);
+/** Return true if `a` and `b` are equal, or are both finite and differ by
+ *  at most `abs` or by at most `rel` times the larger of their magnitudes.
+ *  NaNs are never close, and infinities are only close to themselves.
+ */
+template <typename T> bool is_close(T a, T b, T rel, T abs) {
+  const T diff = a - b, tolerance = close_tolerance(a, b, rel, abs);
+  return (a == b) | (is_finite(a) & is_finite(b) &
+                     ((diff < 0 ? -diff : diff) <= tolerance));
 }
-//----[ TestNode ]--------------------------------------------------------------
-struct TestNode {
-  TestNode(NodeType type, Status status, std::string expr, uint32_t line,
-           std::string str_tags = "", payload_fn fn = nullptr)
-      : payload{fn}, expr{expr}, tags{}, line{line}, type{type}, status{status},
-        new_run{false}, children_{} {
-    if (is_container(type) && !str_tags.empty()) {
-      split_string(str_tags, tags);
-    } else {
-      tags.emplace_back(str_tags);
-    }
-    if (expr == "Anonymous Node" || expr == "") {
-      if (type == NodeType::Section) {
-        this->expr = "Anonymous section (line " + std::to_string(line) + ")";
-      } else {
-        this->expr = "Anonymous block (line " + std::to_string(line) + ")";
-      }
-    }
-  }
 
-  void push_child(uint32_t index) { children_.emplace_back(index); }
-  auto begin() const -> std::vector<uint32_t>::const_iterator {
-    return children_.begin();
+/** Count the pairs among the first `size` elements from `a` and `b` which
+ *  are not close. The loop has no branches or early exits, so compilers can
+ *  vectorise it over contiguous ranges of arithmetic types.
+ */
+template <typename T, typename IterA, typename IterB>
+size_t count_far(IterA a, IterB b, size_t size, T rel, T abs) {
+  size_t far = 0;
+  for (size_t index = 0; index < size; ++index, ++a, ++b) {
+    far += !is_close(static_cast<T>(*a), static_cast<T>(*b), rel, abs);
   }
-  auto end() const -> std::vector<uint32_t>::const_iterator {
-    return children_.end();
+  return far;
+}
+
+//! Compares two values for ENSURE_APPROX and VERIFY_APPROX.
+template <typename T> class ApproxCheck {
+public:
+  ApproxCheck(T lhs, T rhs, T rel, T abs)
+      : lhs_{lhs}, rhs_{rhs}, rel_{rel}, abs_{abs} {}
+
+  operator ExprResult() const {
+    return ExprResult{is_close(lhs_, rhs_, rel_, abs_), &expand, this};
   }
-  bool empty() const { return children_.empty(); }
 
-  payload_fn payload; //<! The test function, if this is a test block.
-  std::string
-      expr; //<! The name or string representation of the test expression.
-  std::vector<std::string> tags; //<! A list of tags for this block or section.
-  uint32_t line;                 //<! The line this TestNode was invoked from.
-  NodeType type;                 //<! The type of this TestNode.
-  Status status; //<! Whether or not the test expression evaluated true.
-  bool new_run;  //<! If this node is the beginning of a new run.
 private:
-  std::vector<uint32_t>
-      children_; //<! Indices of child nodes within the TestReferee.
+  static std::string expand(const void *check, const void *, const char *) {
+    const ApproxCheck &self = *static_cast<const ApproxCheck *>(check);
+    std::string text = value_string(self.lhs_) + " vs " +
+                       value_string(self.rhs_) + ", error " +
+                       value_string(close_error(self.lhs_, self.rhs_));
+    if (is_finite(self.lhs_) && is_finite(self.rhs_)) {
+      text += ", tolerance " + value_string(close_tolerance(
+                                   self.lhs_, self.rhs_, self.rel_, self.abs_));
+    }
+    return text;
+  }
+
+  T lhs_, rhs_, rel_, abs_;
 };
 
-//----[ Test Referee ]----------------------------------------------------------
-class TestReferee {
-  using NodePredicate = bool (*)(const TestNode &);
-  enum class TagMatchMode { None, Any, All };
+template <typename A, typename B>
+ApproxCheck<close_type<A, B>> approx(const A &lhs, const B &rhs, double rel,
+                                     double abs) {
+  using T = close_type<A, B>;
+  return {static_cast<T>(lhs), static_cast<T>(rhs), static_cast<T>(rel),
+          static_cast<T>(abs)};
+}
+
+/** Compares two ranges element by element for ENSURE_ALL_CLOSE and
+ *  VERIFY_ALL_CLOSE, recording one result for the whole range. The ranges
+ *  are only counted over when constructed; the maximum error and the first
+ *  pairs which differ are found by a second pass, only if a report is made.
+ */
+template <typename RangeA, typename RangeB> class AllCloseCheck {
+  using IterA = decltype(std::begin(std::declval<const RangeA &>()));
+  using IterB = decltype(std::begin(std::declval<const RangeB &>()));
+  using T = close_type<typename std::iterator_traits<IterA>::value_type,
+                       typename std::iterator_traits<IterB>::value_type>;
+  enum : size_t { MAX_LISTED = 5 }; //<! Pairs which differ to report.
 
 public:
-  TestReferee()
-      : nodes_{}, filter_tags_{}, node_stack_{}, section_stack_{},
-        next_section_{}, level_{0}, tag_match_mode_{TagMatchMode::None},
-        expand_all_{false}, exiting_{false}, verbose_{false} {}
+  AllCloseCheck(const RangeA &lhs, const RangeB &rhs, double rel, double abs)
+      : lhs_(lhs), rhs_(rhs), rel_{static_cast<T>(rel)},
+        abs_{static_cast<T>(abs)},
+        lhs_size_{static_cast<size_t>(
+            std::distance(std::begin(lhs), std::end(lhs)))},
+        rhs_size_{static_cast<size_t>(
+            std::distance(std::begin(rhs), std::end(rhs)))},
+        far_{count_far(std::begin(lhs), std::begin(rhs), size(), rel_,
+                       abs_)} {}
 
-  /** Initialise the TestReferee with command line arguments. Failure will
-   *  return an ExprResult object containing an error message.
-   */
-  ExprResult init(int argc, const char *argv[]) {
-    if (argc == 1)
-      return {true, ""};
-    int curr = 1;
-    do {
-      std::string arg{argv[curr]};
-      if (arg.length() == 2) {
-        if (arg[1] == 't' || arg[1] == 'x') {
-          if (curr + 1 == argc || argv[curr + 1][0] == '-') {
-            return {false, "No tags specified!"};
-          } else if (tag_match_mode_ != TagMatchMode::None) {
-            return {false, "Cannot mix -t and -x!"};
-          }
-          split_string(argv[++curr], filter_tags_);
-        }
-        switch (arg[1]) {
-        case 'e':
-          expand_all_ = true;
-          verbose_ = true;
-          break;
-        case 'h':
-          return {false, ""};
-          break;
-        case 't':
-          tag_match_mode_ = TagMatchMode::Any;
-          break;
-        case 'v':
-          verbose_ = true;
-          break;
-        case 'x':
-          tag_match_mode_ = TagMatchMode::All;
-          break;
-        default:
-          return {false, arg + " is not a valid argument!"};
-          break;
-        }
-      } else {
-        return {false, arg + " is not a valid argument!"};
-      }
-      ++curr;
-    } while (curr < argc);
-    return {true, ""};
+  operator ExprResult() const {
+    return ExprResult{far_ == 0 && lhs_size_ == rhs_size_, &expand, this};
   }
 
-  //! Evaluate each test case, then print the results to stdout.
-  int run_tests() {
-    NodePredicate predicate = verbose_ ? any_node : node_failed;
-    const uint32_t num_blocks = evaluate_blocks();
+private:
+  size_t size() const {
+    return lhs_size_ < rhs_size_ ? lhs_size_ : rhs_size_;
+  }
 
-    if (num_blocks == 0) {
-      std::cout << "No test blocks found!" << std::endl;
-      return EXIT_FAILURE;
-    }
+  static std::string expand(const void *check, const void *, const char *) {
+    return static_cast<const AllCloseCheck *>(check)->describe();
+  }
 
-    const auto end = nodes_.begin() + num_blocks;
-    for (auto block = nodes_.begin(); block != end; ++block) {
-      if (!block->empty() && predicate(*block)) {
-        describe_node(*block);
-        enumerate_children(*block, predicate);
-        std::cout << std::endl << std::endl;
-      }
-    }
-    // list failed tests
-    const auto num_tests = std::count_if(nodes_.begin(), nodes_.end(), is_test);
-    const auto num_failed =
-        std::count_if(nodes_.begin(), nodes_.end(), is_failed_test);
-    const auto blocks_failed =
-        std::count_if(nodes_.begin(), nodes_.end(), is_failed_block);
-
-    if (num_failed == 0) {
-      std::cout << "------------------ " << Status::Succeed
-                << "------------------" << std::endl
-                << std::endl;
-      std::cout << CLIAttr::Green << "All " << num_tests << " tests passed."
-                << std::endl;
-      std::cout << "All " << num_blocks << " blocks completed successfully."
-                << std::endl;
-      std::cout << CLIAttr::Reset << std::endl;
-      return EXIT_SUCCESS;
-    } else {
-      std::cout << "------------------ " << Status::Fail << "------------------"
-                << std::endl
-                << std::endl;
-      std::cout << CLIAttr::Green << num_tests - num_failed << " tests passed.";
-      std::cout << CLIAttr::Reset << " | " << CLIAttr::Red << num_failed
-                << " tests failed." << std::endl;
-
-      std::cout << CLIAttr::Green << num_blocks - blocks_failed
-                << " blocks passed.";
-      std::cout << CLIAttr::Reset << " | " << CLIAttr::Red << blocks_failed
-                << " blocks failed." << std::endl;
-      std::cout << CLIAttr::Reset << std::endl;
-      return EXIT_FAILURE;
+  std::string describe() const {
+    std::string text;
+    if (lhs_size_ != rhs_size_) {
+      text = "sizes differ, " + std::to_string(lhs_size_) + " vs " +
+             std::to_string(rhs_size_) + "; ";
     }
-    // you may ask yourself, well, how did i get here?
-    return EXIT_FAILURE;
+    text += far_ == 0 ? "all " + std::to_string(size()) + " elements close"
+                      : std::to_string(far_) + " of " +
+                            std::to_string(size()) + " elements differ";
+    if (size() == 0) {
+      return text;
+    }
+    T max_error = 0;
+    size_t max_index = 0, listed = 0;
+    std::string pairs;
+    IterA lhs = std::begin(lhs_);
+    IterB rhs = std::begin(rhs_);
+    for (size_t index = 0; index < size(); ++index, ++lhs, ++rhs) {
+      const T a = static_cast<T>(*lhs), b = static_cast<T>(*rhs);
+      const T diff = close_error(a, b);
+      // The first NaN error is the largest, then the first infinite one.
+      if (diff > max_error || (diff != diff && max_error == max_error)) {
+        max_error = diff;
+        max_index = index;
+      }
+      if (listed < MAX_LISTED && !is_close(a, b, rel_, abs_)) {
+        pairs += (listed++ == 0 ? "; first [" : ", [") +
+                 std::to_string(index) + "] " + value_string(a) + " vs " +
+                 value_string(b);
+      }
+    }
+    return text + ", max error " + value_string(max_error) + " at [" +
+           std::to_string(max_index) + "]" + pairs;
   }
 
-  //! Run the payload and update the status for each block.
-  uint32_t evaluate_blocks() {
-    if (!filter_tags_.empty()) {
-      nodes_.erase(std::remove_if(nodes_.begin(), nodes_.end(),
-                                  [this](const TestNode &node) {
-                                    return !matches_tags(node);
-                                  }),
-                   nodes_.end());
+  const RangeA &lhs_;
+  const RangeB &rhs_;
+  T rel_, abs_;
+  size_t lhs_size_; //<! Number of elements in lhs_.
+  size_t rhs_size_; //<! Number of elements in rhs_.
+  size_t far_;      //<! Pairs of elements which are not close.
+};
+
+template <typename RangeA, typename RangeB>
+AllCloseCheck<RangeA, RangeB> all_close(const RangeA &lhs, const RangeB &rhs,
+                                        double rel, double abs) {
+  return {lhs, rhs, rel, abs};
+}
+
+//----[ Generated values ]------------------------------------------------------
+//! The integers in [first, last), for GENERATE_RANGE.
+template <typename T> struct IntegerRange {
+  T first; //<! First value.
+  T last;  //<! One past the last value.
+};
+
+template <typename T, typename U>
+IntegerRange<typename std::common_type<T, U>::type> make_range(T first,
+                                                              U last) {
+  return {first, last};
+}
+
+//! Number of values in a container to generate from.
+template <typename Range> size_t value_count(const Range &values) {
+  return static_cast<size_t>(
+      std::distance(std::begin(values), std::end(values)));
+}
+
+template <typename T> size_t value_count(const IntegerRange<T> &values) {
+  return values.last > values.first
+             ? static_cast<size_t>(values.last - values.first)
+             : 0;
+}
+
+//! Value at an index of a container to generate from.
+template <typename Range>
+auto value_at(const Range &values, size_t index) ->
+    typename std::decay<decltype(*std::begin(values))>::type {
+  return *std::next(std::begin(values), index);
+}
+
+template <typename T> T value_at(const IntegerRange<T> &values, size_t index) {
+  return static_cast<T>(values.first + index);
+}
+
+//----[ NameTags ]--------------------------------------------------------------
+//! Name and tags of a block or section; both are referenced, not copied.
+struct NameTags {
+  NameTags(const char *name = "Anonymous Node", const char *tags = "")
+      : name{name}, tags{tags} {}
+  const char *name; //<! Name of the block.
+  const char *tags; //<! Tags for the block.
+};
+
+//----[ StringRef ]-------------------------------------------------------------
+/** A non-owning view of a string. Text from string literals is referenced
+ *  directly; text built at run time must be kept alive by a TextPool.
+ */
+struct StringRef {
+  StringRef() : data{""}, size{0} {}
+  StringRef(const char *str)
+      : data{str}, size{static_cast<uint32_t>(std::strlen(str))} {}
+  StringRef(const char *str, size_t size)
+      : data{str}, size{static_cast<uint32_t>(size)} {}
+
+  bool empty() const { return size == 0; }
+  std::string str() const { return std::string(data, size); }
+  const char *begin() const { return data; }
+  const char *end() const { return data + size; }
+
+  bool operator==(const StringRef &other) const {
+    return size == other.size && std::memcmp(data, other.data, size) == 0;
+  }
+  bool operator!=(const StringRef &other) const { return !(*this == other); }
+
+  const char *data; //<! Start of the string; not necessarily null-terminated.
+  uint32_t size;    //<! Length of the string.
+};
+
+//----[ PathStep ]--------------------------------------------------------------
+/** One step on the path through a block to a leaf: a section, or one of the
+ *  values of a GENERATE, which lasts until the end of the enclosing scope.
+ */
+struct PathStep {
+  bool operator==(const PathStep &other) const {
+    return line == other.line && value == other.value;
+  }
+  bool operator!=(const PathStep &other) const { return !(*this == other); }
+
+  uint32_t line;  //<! Line of the section or GENERATE.
+  uint32_t value; //<! Index of the generated value; 0 for sections.
+  uint32_t count; //<! Number of generated values; 0 for sections.
+  bool entered;   //<! If the step was entered on this run.
+};
+
+//----[ Allocation counts ]-----------------------------------------------------
+/** Running allocation counts of one thread. Only allocations made within
+ *  a measured scope, and outside any AllocationPause, are counted. Bytes
+ *  freed are taken from the thread which frees them, so `live` may go below
+ *  zero.
+ */
+struct AllocationCounters {
+  uint64_t count;  //<! Allocations counted.
+  uint64_t bytes;  //<! Bytes allocated.
+  int64_t live;    //<! Bytes allocated less bytes freed.
+  int64_t peak;    //<! Highest value of `live` in the innermost scope.
+  uint32_t scopes; //<! Depth of measured scopes.
+  uint32_t paused; //<! Depth of AllocationPause guards in effect.
+};
+
+//! The allocations made over a block, section or allocation test.
+struct AllocationStats {
+  uint64_t count;      //<! Number of allocations.
+  uint64_t bytes;      //<! Total bytes allocated.
+  uint64_t peak_bytes; //<! Highest bytes live, above those live on entry.
+};
+
+//! The allocation counts of the calling thread.
+inline AllocationCounters &allocation_counters() {
+  static thread_local AllocationCounters counters{0, 0, 0, 0, 0, 0};
+  return counters;
+}
+
+//! True once the operator new of CATAPLASM_TRACK_ALLOCATIONS is installed.
+inline bool &allocations_tracked() {
+  static bool tracked = false;
+  return tracked;
+}
+
+//! Leaves uncounted the allocations made by the referee while in scope.
+struct AllocationPause {
+  AllocationPause() { ++allocation_counters().paused; }
+  ~AllocationPause() { --allocation_counters().paused; }
+  AllocationPause(const AllocationPause &) = delete;
+  AllocationPause &operator=(const AllocationPause &) = delete;
+};
+
+/** The start of a scope over which allocations are measured. The scopes of
+ *  a thread are ended by measure_allocations() in reverse order; ending a
+ *  scope also ends any scope left open within it.
+ */
+struct AllocationMark {
+  AllocationCounters start; //<! Counts on entry.
+  int64_t outer_peak;       //<! Peak of the enclosing scope.
+};
+
+//! Begin measuring the allocations of the calling thread.
+inline AllocationMark mark_allocations() {
+  AllocationCounters &counters = allocation_counters();
+  const AllocationMark mark{counters, counters.peak};
+  counters.peak = counters.live;
+  ++counters.scopes;
+  return mark;
+}
+
+//! End a scope begun by mark_allocations(), returning its allocations.
+inline AllocationStats measure_allocations(const AllocationMark &mark) {
+  AllocationCounters &counters = allocation_counters();
+  const int64_t peak = counters.peak - mark.start.live;
+  const AllocationStats stats{counters.count - mark.start.count,
+                              counters.bytes - mark.start.bytes,
+                              static_cast<uint64_t>(peak > 0 ? peak : 0)};
+  if (mark.outer_peak > counters.peak) {
+    counters.peak = mark.outer_peak;
+  }
+  counters.scopes = mark.start.scopes;
+  return stats;
+}
+
+//! Measures allocations from construction until finish() or destruction.
+class AllocationScope {
+public:
+  AllocationScope() : mark_(mark_allocations()), stats_{}, finished_{false} {}
+  ~AllocationScope() { finish(); }
+  AllocationScope(const AllocationScope &) = delete;
+  AllocationScope &operator=(const AllocationScope &) = delete;
+
+  //! End the scope, if it has not ended, and return its allocations.
+  AllocationStats finish() {
+    if (!finished_) {
+      stats_ = measure_allocations(mark_);
+      finished_ = true;
+    }
+    return stats_;
+  }
+
+private:
+  AllocationMark mark_;
+  AllocationStats stats_;
+  bool finished_;
+};
+
+//----[ Performance counts ]----------------------------------------------------
+//! Counts of the hardware events; events which are not counted read zero.
+struct PerfCounts {
+  //! The events counted by --perf-counters, as indices and bits.
+  enum : uint32_t {
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    BRANCH_MISSES,
+    NUM_EVENTS,
+  };
+
+  /** Counts since `start`. If the kernel multiplexed the counters, so that
+   *  they ran for only part of the time they were enabled, the counts are
+   *  scaled up by the ratio of the two times.
+   */
+  PerfCounts operator-(const PerfCounts &start) const {
+    PerfCounts counts;
+    const uint64_t enabled = enabled_ns - start.enabled_ns;
+    const uint64_t running = running_ns - start.running_ns;
+    const double scale = running > 0 && running < enabled
+                             ? static_cast<double>(enabled) / running
+                             : 1.0;
+    for (uint32_t event = 0; event < NUM_EVENTS; ++event) {
+      counts.values[event] = static_cast<uint64_t>(
+          (values[event] - start.values[event]) * scale + 0.5);
+    }
+    counts.enabled_ns = counts.running_ns = enabled;
+    return counts;
+  }
+  PerfCounts &operator+=(const PerfCounts &other) {
+    for (uint32_t event = 0; event < NUM_EVENTS; ++event) {
+      values[event] += other.values[event];
+    }
+    enabled_ns += other.enabled_ns;
+    running_ns += other.running_ns;
+    return *this;
+  }
+
+  uint64_t values[NUM_EVENTS]; //<! Count of each event.
+  uint64_t enabled_ns;         //<! Time the counters were enabled.
+  uint64_t running_ns;         //<! Time the counters were counting.
+};
+
+//----[ Hooks ]-----------------------------------------------------------------
+/*  The entry points of the macros, which forward to the referee of the
+ *  calling thread. They are defined once, in the TU which defines
+ *  CATAPLASM_IMPLEMENTATION or CATAPLASM_MAIN, so that other test TUs never
+ *  see the referee.
+ */
+
+//! Push the node for an assertion, returning its status.
+Status push_result(NodeType type, Status pass, Status fail,
+                   const ExprResult &result, uint32_t line, const char *expr);
+
+//! Push the node for an exception test, or an exception which escaped one.
+void push_exception(std::exception_ptr excep, NodeType type, Status status,
+                    const char *expr, uint32_t line);
+
+//! Push the node for an allocation test, returning its status.
+Status push_allocations(NodeType type, const AllocationStats &stats,
+                        uint64_t limit, uint32_t line, const char *expr);
+
+//! Push a FAIL or PASS node.
+void push_node(NodeType type, Status status, const char *expr, uint32_t line);
+
+//! Push a NOTICE or WARN node, copying its message.
+void push_message(NodeType type, const std::string &message, uint32_t line);
+
+//! Status of the most recent node, including passing tests not stored.
+Status last_status();
+
+//! Line of the most recent node, including passing tests not stored.
+uint32_t last_line();
+
+/** Push the step of a GENERATE with `count` values; its `value` is the index
+ *  of the value to take on this run. Throws if there are no values.
+ */
+PathStep push_generator(uint32_t line, const char *expr, size_t count);
+
+//! Enter the step pushed by push_generator(), named for its value.
+void enter_generated(const char *expr, const std::string &value);
+
+/** Return the running block's fixture, building it on the block's first
+ *  run; `destroy` deletes it when the block is finished.
+ */
+const void *block_fixture(void *(*build)(), void (*destroy)(void *));
+
+class PropertyCases;
+
+/** Check a PROPERTY, searching its cases and shrinking the first which
+ *  fails; `params` are its parameters as written.
+ */
+void run_property(PropertyCases &cases, const char *params);
+
+//! Store "property" followed by the given tags, for the life of the program.
+const char *store_property_tags(const char *tags);
+
+//----[ Loaders ]---------------------------------------------------------------
+struct BlockLoader {
+  BlockLoader(NodeType type, Status status, payload_fn fn, const NameTags &data,
+              uint32_t line, const char *file);
+};
+
+struct SectionLoader {
+  SectionLoader(uint32_t line_number, NameTags name_tags);
+  ~SectionLoader();
+  operator bool() const { return can_run_; }
+
+  bool can_run_;
+  StringRef name_;
+  uint32_t line_;
+};
+
+/** Drives an ENSURE_PEAK_BYTES_LE block, running its body once and then
+ *  pushing the result, measured over the body.
+ */
+class PeakBytesCheck {
+public:
+  PeakBytesCheck(uint32_t line, uint64_t limit, const char *source)
+      : scope_{}, limit_{limit}, source_{source}, line_{line}, ran_{false} {}
+
+  //! Return true if the body should be run.
+  bool next() {
+    if (!ran_) {
+      ran_ = true;
+      return true;
+    }
+    push_allocations(NodeType::EnsurePeakBytes, scope_.finish(), limit_, line_,
+                     source_);
+    return false;
+  }
+
+private:
+  AllocationScope scope_;
+  uint64_t limit_;
+  const char *source_;
+  uint32_t line_;
+  bool ran_;
+};
+
+//----[ Benchmarks ]------------------------------------------------------------
+/** Prevent the compiler from optimising away the computation of `value`,
+ *  for use in BENCHMARK blocks.
+ */
+template <typename T> inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static const void *volatile sink;
+  sink = &value;
+#endif
+}
+
+//! Prevent the compiler from optimising away or reordering memory writes.
+inline void clobber_memory() {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : : "memory");
+#else
+  std::atomic_signal_fence(std::memory_order_acq_rel);
+#endif
+}
+
+/** Drives the loop of a BENCHMARK. The number of iterations per batch is
+ *  doubled until a batch takes at least MIN_BATCH_NS, and batches continue
+ *  until WARMUP_NS have passed; then the configured number of batches are
+ *  timed as samples. `next()` is called once per iteration, and only reads
+ *  the clock between batches.
+ */
+class BenchmarkRunner {
+public:
+  BenchmarkRunner(uint32_t line, const char *name);
+
+  //! Return true if the body should be run (again).
+  bool next() {
+    if (++iteration_ < batch_size_) {
+      return true;
+    }
+    return advance();
+  }
+
+private:
+  enum : uint64_t {
+    MIN_BATCH_NS = 1000000,
+    WARMUP_NS = 10000000,
+    MAX_BATCH_SIZE = uint64_t(1) << 40,
+  };
+
+  //! Finish a batch: calibrate, or record a sample.
+  bool advance();
+
+  //! Read the monotonic clock, in nanoseconds.
+  static uint64_t now_ns();
+
+  StringRef name_;
+  uint32_t line_;
+  uint64_t iteration_;  //<! Iterations run in the current batch.
+  uint64_t batch_size_; //<! Iterations per batch; 0 before the first.
+  uint32_t num_samples_;
+  bool warming_up_;
+  bool count_perf_; //<! If hardware events are counted over the samples.
+  uint64_t start_ns_;           //<! Start of the current batch.
+  uint64_t warmup_start_ns_;    //<! Start of the first batch.
+  PerfCounts perf_start_;       //<! Event counts at the first sample.
+  std::vector<double> samples_; //<! Time per iteration of each sample.
+};
+
+//----[ Generators ]------------------------------------------------------------
+/** Return the value of a GENERATE_RANGE or GENERATE_FROM for this run. Each
+ *  value is entered like a section, which lasts until the end of the
+ *  enclosing section or block, and is reported as a section named for the
+ *  value.
+ */
+template <typename Range>
+auto generate_from(uint32_t line, const char *expr, const Range &values)
+    -> decltype(value_at(values, 0)) {
+  AllocationPause pause;
+  const PathStep step = push_generator(line, expr, value_count(values));
+  auto value = value_at(values, step.value);
+  if (step.entered) {
+    enter_generated(expr, value_string(value));
+  }
+  return value;
+}
+
+//! Return the value of the GENERATE on `line` for this run.
+template <typename T>
+T generate(uint32_t line, const char *expr, std::initializer_list<T> values) {
+  return generate_from(line, expr, values);
+}
+
+//----[ Fixtures ]--------------------------------------------------------------
+template <typename Fixture> void *build_fixture() { return new Fixture(); }
+
+template <typename Fixture> void destroy_fixture(void *fixture) {
+  delete static_cast<Fixture *>(fixture);
+}
+
+/** Return a copy of the running block's fixture. Each run after the first,
+ *  to reach another leaf, copies it instead of building it again.
+ */
+template <typename Fixture> Fixture copy_fixture() {
+  return Fixture(*static_cast<const Fixture *>(block_fixture(
+      &build_fixture<Fixture>, &destroy_fixture<Fixture>)));
+}
+
+//----[ Properties ]------------------------------------------------------------
+//! The random source of PROPERTY cases: a splitmix64 sequence from a seed.
+class CaseRng {
+public:
+  using result_type = uint64_t;
+
+  explicit CaseRng(uint64_t seed) : state_{seed} {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return ~result_type(0); }
+
+  result_type operator()() {
+    uint64_t value = state_ += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+  }
+
+  //! An integer uniformly distributed in [0, span], by rejection.
+  uint64_t uniform(uint64_t span) {
+    if (span == max()) {
+      return (*this)();
+    }
+    const uint64_t count = span + 1;
+    const uint64_t skip = (max() - count + 1) % count;
+    uint64_t value = (*this)();
+    while (value < skip) {
+      value = (*this)();
+    }
+    return value % count;
+  }
+
+  //! A real uniformly distributed in [0, 1), from the top 53 bits.
+  double unit() {
+    return static_cast<double>((*this)() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+private:
+  uint64_t state_;
+};
+
+//! Integers uniformly distributed in [min, max], shrinking towards zero.
+template <typename T> struct IntegerGenerator {
+  using value_type = T;
+
+  T generate(CaseRng &rng) const {
+    // Computed modulo 2^64, as max - min may overflow T.
+    const uint64_t first = static_cast<uint64_t>(min);
+    return static_cast<T>(
+        first + rng.uniform(static_cast<uint64_t>(max) - first));
+  }
+
+  //! Simpler values: the target, halfway to it, and one step towards it.
+  std::vector<T> shrink(T value) const {
+    const T target = min > 0 ? min : (max < 0 ? max : 0);
+    std::vector<T> candidates;
+    if (value == target) {
+      return candidates;
+    }
+    candidates.push_back(target);
+    const T half = static_cast<T>(value - (value - target) / 2);
+    if (half != target && half != value) {
+      candidates.push_back(half);
+    }
+    const T step = static_cast<T>(value > target ? value - 1 : value + 1);
+    if (step != target && step != half) {
+      candidates.push_back(step);
+    }
+    return candidates;
+  }
+
+  T min; //<! Smallest value.
+  T max; //<! Largest value.
+};
+
+template <typename T> IntegerGenerator<T> integers(T min, T max) {
+  return {min, max};
+}
+
+//! Reals uniformly distributed in [min, max), shrinking towards zero.
+template <typename T> struct RealGenerator {
+  using value_type = T;
+
+  T generate(CaseRng &rng) const {
+    const T value = min + (max - min) * static_cast<T>(rng.unit());
+    return value < max ? value : min;
+  }
+
+  //! Simpler values: the target, halfway to it, and the integer part.
+  std::vector<T> shrink(T value) const {
+    const T target = min > 0 ? min : (max < 0 ? max : 0);
+    std::vector<T> candidates;
+    if (value == target) {
+      return candidates;
+    }
+    candidates.push_back(target);
+    const T half = value - (value - target) / 2;
+    if (half != target && half != value) {
+      candidates.push_back(half);
+    }
+    const T whole = whole_part(value);
+    if (whole != value && whole != target && whole >= min && whole < max) {
+      candidates.push_back(whole);
+    }
+    return candidates;
+  }
+
+  T min; //<! Smallest value.
+  T max; //<! Bound on the largest value.
+
+private:
+  //! Truncate towards zero; larger reals have no fractional part.
+  static T whole_part(T value) {
+    const T limit = static_cast<T>(INT64_MAX);
+    return value > -limit && value < limit
+               ? static_cast<T>(static_cast<int64_t>(value))
+               : value;
+  }
+};
+
+template <typename T> RealGenerator<T> reals(T min, T max) {
+  return {min, max};
+}
+
+//! True or false with equal probability, shrinking to false.
+struct BooleanGenerator {
+  using value_type = bool;
+
+  bool generate(CaseRng &rng) const { return (rng() & 1) != 0; }
+
+  std::vector<bool> shrink(bool value) const {
+    return value ? std::vector<bool>{false} : std::vector<bool>{};
+  }
+};
+
+inline BooleanGenerator booleans() { return {}; }
+
+/** Vectors of between min_size and max_size elements from another
+ *  generator, shrinking by removing halves, then single elements, then by
+ *  shrinking elements.
+ */
+template <typename Generator> struct VectorGenerator {
+  using element_type = typename Generator::value_type;
+  using value_type = std::vector<element_type>;
+
+  value_type generate(CaseRng &rng) const {
+    const size_t size = min_size + static_cast<size_t>(rng.uniform(
+                                       max_size - min_size));
+    value_type value;
+    value.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+      value.push_back(elements.generate(rng));
+    }
+    return value;
+  }
+
+  std::vector<value_type> shrink(const value_type &value) const {
+    std::vector<value_type> candidates;
+    const size_t half = value.size() / 2;
+    if (half > 0 && value.size() - half >= min_size) {
+      candidates.emplace_back(value.begin() + half, value.end());
+      candidates.emplace_back(value.begin(), value.end() - half);
+    }
+    if (value.size() > min_size) {
+      for (size_t i = 0; i < value.size(); ++i) {
+        candidates.push_back(value);
+        candidates.back().erase(candidates.back().begin() + i);
+      }
+    }
+    for (size_t i = 0; i < value.size(); ++i) {
+      for (const auto &element : elements.shrink(value[i])) {
+        candidates.push_back(value);
+        candidates.back()[i] = element;
+      }
+    }
+    return candidates;
+  }
+
+  Generator elements; //<! Generator of each element.
+  size_t min_size;    //<! Fewest elements.
+  size_t max_size;    //<! Most elements.
+};
+
+template <typename Generator>
+VectorGenerator<Generator> vectors(Generator elements, size_t min_size,
+                                   size_t max_size) {
+  return {elements, min_size, max_size};
+}
+
+//! Format a property argument, including vectors of printable values.
+template <typename T> std::string argument_string(const T &value) {
+  return value_string(value);
+}
+
+inline std::string argument_string(bool value) {
+  return value ? "true" : "false";
+}
+
+//! Small integers are printed as numbers, not as characters.
+inline std::string argument_string(signed char value) {
+  return std::to_string(value);
+}
+
+inline std::string argument_string(unsigned char value) {
+  return std::to_string(value);
+}
+
+template <typename T>
+std::string argument_string(const std::vector<T> &values) {
+  std::string text = "[";
+  for (size_t i = 0; i < values.size(); ++i) {
+    text += (i == 0 ? "" : ", ") + argument_string(values[i]);
+  }
+  return text + "]";
+}
+
+template <size_t... I> struct IndexSequence {};
+template <size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+template <size_t... I> struct MakeIndexSequence<0, I...> {
+  using type = IndexSequence<I...>;
+};
+
+/** The generators of a PROPERTY, which generate, shrink and format tuples
+ *  of arguments for its body.
+ */
+template <typename... Generators> class Property {
+  using Indices = typename MakeIndexSequence<sizeof...(Generators)>::type;
+
+public:
+  using Args = std::tuple<typename Generators::value_type...>;
+
+  explicit Property(const Generators &... generators)
+      : generators_{generators...} {}
+
+  Args generate(CaseRng &rng) const { return generate(rng, Indices{}); }
+
+  //! Candidates simpler than `args`, each changing one argument.
+  std::vector<Args> shrink(const Args &args) const {
+    std::vector<Args> candidates;
+    shrink(args, candidates, Indices{});
+    return candidates;
+  }
+
+  //! Format the arguments as "(a, b, ...)".
+  std::string describe(const Args &args) const {
+    std::string text;
+    describe(args, text, Indices{});
+    return "(" + text + ")";
+  }
+
+  template <typename Body> void call(Body body, const Args &args) const {
+    call(body, args, Indices{});
+  }
+
+private:
+  template <size_t... I>
+  Args generate(CaseRng &rng, IndexSequence<I...>) const {
+    // Braced initialisers are evaluated in order, so draws are reproducible.
+    return Args{std::get<I>(generators_).generate(rng)...};
+  }
+
+  template <size_t... I>
+  void shrink(const Args &args, std::vector<Args> &candidates,
+              IndexSequence<I...>) const {
+    const int expand[] = {0, (shrink_at<I>(args, candidates), 0)...};
+    (void)expand;
+  }
+
+  template <size_t I>
+  void shrink_at(const Args &args, std::vector<Args> &candidates) const {
+    const auto values = std::get<I>(generators_).shrink(std::get<I>(args));
+    for (const auto &value : values) {
+      candidates.push_back(args);
+      std::get<I>(candidates.back()) = value;
+    }
+  }
+
+  template <size_t... I>
+  void describe(const Args &args, std::string &text,
+                IndexSequence<I...>) const {
+    const int expand[] = {
+        0, (text += (I == 0 ? "" : ", ") + argument_string(std::get<I>(args)),
+            0)...};
+    (void)expand;
+  }
+
+  template <typename Body, size_t... I>
+  void call(Body body, const Args &args, IndexSequence<I...>) const {
+    body(std::get<I>(args)...);
+  }
+
+  std::tuple<Generators...> generators_;
+};
+
+/** The cases of a PROPERTY, behind virtual calls so that the referee can
+ *  search them without seeing the types of its arguments. The current
+ *  counterexample, and the simpler candidates shrunk from it, are kept here.
+ *  The const members may be called from several threads at once.
+ */
+class PropertyCases {
+public:
+  virtual ~PropertyCases() {}
+
+  //! Run the body with the case generated from `seed`.
+  virtual void run_case(uint64_t seed) const = 0;
+
+  //! Run the body with candidate `index` of the current counterexample.
+  virtual void run_candidate(size_t index) const = 0;
+
+  //! Run the body with the current counterexample.
+  virtual void run_counterexample() const = 0;
+
+  //! Format the current counterexample as "(a, b, ...)".
+  virtual std::string describe_counterexample() const = 0;
+
+  /** Take the case generated from `seed` as the counterexample, returning
+   *  the number of candidates simpler than it.
+   */
+  virtual size_t take_case(uint64_t seed) = 0;
+
+  //! Take candidate `index` as the counterexample, likewise.
+  virtual size_t take_candidate(size_t index) = 0;
+};
+
+template <typename Body, typename... Generators>
+class PropertyCasesOf : public PropertyCases {
+  using Args = typename Property<Generators...>::Args;
+
+public:
+  PropertyCasesOf(Body body, const Generators &... generators)
+      : body_{body}, property_{generators...}, counterexample_{},
+        candidates_{} {}
+
+  void run_case(uint64_t seed) const override {
+    CaseRng rng{seed};
+    property_.call(body_, property_.generate(rng));
+  }
+
+  void run_candidate(size_t index) const override {
+    property_.call(body_, candidates_[index]);
+  }
+
+  void run_counterexample() const override {
+    property_.call(body_, counterexample_);
+  }
+
+  std::string describe_counterexample() const override {
+    return property_.describe(counterexample_);
+  }
+
+  size_t take_case(uint64_t seed) override {
+    CaseRng rng{seed};
+    counterexample_ = property_.generate(rng);
+    return shrink();
+  }
+
+  size_t take_candidate(size_t index) override {
+    counterexample_ = candidates_[index];
+    return shrink();
+  }
+
+private:
+  size_t shrink() {
+    candidates_ = property_.shrink(counterexample_);
+    return candidates_.size();
+  }
+
+  Body body_;
+  Property<Generators...> property_;
+  Args counterexample_;
+  std::vector<Args> candidates_; //<! Simpler than counterexample_.
+};
+
+//! Check a PROPERTY whose parameters, as written, are `params`.
+template <typename Body, typename... Generators>
+void check_property(Body body, const char *params,
+                    const Generators &... generators) {
+  PropertyCasesOf<Body, Generators...> cases{body, generators...};
+  run_property(cases, params);
+}
+
+//! Check a PROPERTY given tags, which were read when it was registered.
+template <typename Body, typename... Generators>
+void check_property(Body body, const char *params, const char *,
+                    const Generators &... generators) {
+  check_property(body, params, generators...);
+}
+
+template <typename Fn> const char *property_tags(Fn, std::false_type) {
+  return "property";
+}
+
+template <typename Fn> const char *property_tags(Fn tags, std::true_type) {
+  return store_property_tags(tags());
+}
+
+/** Return the tags of a PROPERTY whose first argument after its parameters
+ *  has type `First`: "property", followed by the result of `first()` if the
+ *  argument is a string of tags rather than a generator.
+ */
+template <typename First, typename Fn> const char *property_tags(Fn first) {
+  return property_tags(first, std::is_convertible<First, const char *>{});
+}
+
+}
+
+#ifdef CATAPLASM_FULL
+namespace cataplasm {
+//----[ CLI colours ]-----------------------------------------------------------
+enum class CLIAttr {
+  Reset,
+  Bold,
+  Red,
+  Green,
+  Yellow,
+  Blue,
+};
+
+static const char *CLIAttrCodes[] = {
+    "\33[0m", "\33[1m", "\33[31m", "\33[32m", "\33[33m", "\33[34m",
+};
+
+//----[ TextPool ]--------------------------------------------------------------
+/** Storage for text built at run time, such as expansions and exception
+ *  messages. Text is copied into chunks which never move, so the StringRefs
+ *  handed out stay valid until the pool is cleared or destroyed.
+ */
+class TextPool {
+public:
+  TextPool() : chunks_{}, used_{0}, capacity_{0} {}
+
+  //! Copy the given text into the pool.
+  StringRef store(StringRef text) {
+    const size_t size = text.size + 1;
+    if (used_ + size > capacity_) {
+      capacity_ = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+      chunks_.emplace_back(new char[capacity_]);
+      used_ = 0;
+    }
+    char *dest = chunks_.back().get() + used_;
+    std::memcpy(dest, text.data, text.size);
+    dest[text.size] = '\0';
+    used_ += size;
+    return StringRef{dest, text.size};
+  }
+  StringRef store(const std::string &text) {
+    return store(StringRef{text.data(), text.size()});
+  }
+
+  //! Take ownership of all text stored in another pool.
+  void merge(TextPool &other) {
+    const auto at = chunks_.empty() ? chunks_.end() : chunks_.end() - 1;
+    chunks_.insert(at, std::make_move_iterator(other.chunks_.begin()),
+                   std::make_move_iterator(other.chunks_.end()));
+    other.chunks_.clear();
+    other.used_ = other.capacity_ = 0;
+  }
+
+  //! Release all stored text.
+  void clear() {
+    chunks_.clear();
+    used_ = capacity_ = 0;
+  }
+
+private:
+  enum : size_t { CHUNK_SIZE = 4096 };
+
+  std::vector<std::unique_ptr<char[]>> chunks_; //<! Allocated chunks.
+  size_t used_;     //<! Bytes used in the last chunk.
+  size_t capacity_; //<! Size of the last chunk.
+};
+
+//----[ Stream manipulators ]---------------------------------------------------
+inline std::ostream &operator<<(std::ostream &os, const StringRef &str) {
+  return os.write(str.data, str.size);
+}
+
+//! Index of the stream flag which suppresses CLIAttr colour codes.
+inline int no_colour_index() {
+  static const int index = std::ios_base::xalloc();
+  return index;
+}
+
+//! Output colour codes from CLIAttr enums, unless disabled for the stream.
+inline std::ostream &operator<<(std::ostream &os, CLIAttr code) {
+  if (os.iword(no_colour_index()) != 0) {
+    return os;
+  }
+  return os << CLIAttrCodes[static_cast<uint8_t>(code)];
+}
+
+inline std::ostream &operator<<(std::ostream &os, NodeType type) {
+  return os << NodeTypeName[static_cast<size_t>(type)];
+}
+
+//! Output status messages from Status enums.
+inline std::ostream &operator<<(std::ostream &os, Status status) {
+  switch (status) {
+  case Status::Succeed:
+    return os << CLIAttr::Green << "[ PASS ] " << CLIAttr::Reset;
+  case Status::Fail:
+    return os << CLIAttr::Red << "[ FAIL ] " << CLIAttr::Reset;
+  case Status::Null:
+  default:
+    return os;
+  }
+}
+
+//----[ Output ]----------------------------------------------------------------
+//! Disable colour codes on a stream unless `file` is a terminal.
+inline void detect_colour(std::ostream &os, FILE *file) {
+#ifdef CATAPLASM_POSIX
+  os.iword(no_colour_index()) = isatty(fileno(file)) ? 0 : 1;
+#else
+  (void)os;
+  (void)file;
+#endif
+}
+
+/** A stream buffer which writes to a FILE in large chunks. Flushing the
+ *  stream, e.g. with std::endl, also flushes the FILE, so reporters should
+ *  end lines with '\n'. The buffer is allocated by the first write, as most
+ *  referees never write.
+ */
+class ChunkedBuffer : public std::streambuf {
+public:
+  explicit ChunkedBuffer(FILE *file, size_t size = 1 << 16)
+      : file_{file}, size_{size}, buffer_{} {}
+  ~ChunkedBuffer() override { sync(); }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (!write_buffer()) {
+      return traits_type::eof();
+    }
+    if (buffer_.empty()) {
+      buffer_.resize(size_);
+      setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+  int sync() override {
+    return write_buffer() && std::fflush(file_) == 0 ? 0 : -1;
+  }
+
+private:
+  //! Write out and empty the buffer.
+  bool write_buffer() {
+    const size_t size = pptr() - pbase();
+    const bool written =
+        size == 0 || std::fwrite(pbase(), 1, size, file_) == size;
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    return written;
+  }
+
+  FILE *file_;
+  size_t size_;              //<! Size of the buffer, once allocated.
+  std::vector<char> buffer_; //<! Pending output, or empty before any.
+};
+
+//----[ Misc functions ]--------------------------------------------------------
+/**
+ * @brief Split a string on `;` and insert views of the resulting strings
+ * into the passed vector.
+ */
+static void split_string(StringRef string, std::vector<StringRef> &vec) {
+  const char *last = string.begin();
+  while (last != string.end()) {
+    const char *pos = std::find(last, string.end(), ';');
+    if (pos != last)
+      vec.emplace_back(last, pos - last);
+    if (pos == string.end())
+      break;
+    last = pos + 1;
+    while (last != string.end() && *last == ' ')
+      ++last;
+  }
+}
+
+/**
+ * @brief Split a path on `/` and insert views of its components into the
+ * passed vector. Unlike split_string, spaces are kept.
+ */
+static void split_path(StringRef string, std::vector<StringRef> &vec) {
+  const char *last = string.begin();
+  for (;;) {
+    const char *pos = std::find(last, string.end(), '/');
+    vec.emplace_back(last, pos - last);
+    if (pos == string.end())
+      break;
+    last = pos + 1;
+  }
+}
+
+/**
+ * @brief Match a string against a glob pattern, in which `*` matches any
+ * run of characters and `?` matches any single character.
+ */
+static bool glob_match(StringRef pattern, StringRef string) {
+  const char *pat = pattern.begin(), *str = string.begin();
+  const char *star = nullptr, *resume = nullptr;
+  while (str != string.end()) {
+    if (pat != pattern.end() && (*pat == '?' || *pat == *str)) {
+      ++pat;
+      ++str;
+    } else if (pat != pattern.end() && *pat == '*') {
+      star = pat++;
+      resume = str;
+    } else if (star) {
+      pat = star + 1;
+      str = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (pat != pattern.end() && *pat == '*')
+    ++pat;
+  return pat == pattern.end();
+}
+
+//----[ Timing ]----------------------------------------------------------------
+//! Wall-clock and CPU time, in nanoseconds.
+struct Timing {
+  uint64_t wall_ns; //<! Monotonic wall-clock time.
+  uint64_t cpu_ns;  //<! CPU time of the running thread.
+
+  Timing operator-(const Timing &start) const {
+    return {wall_ns - start.wall_ns, cpu_ns - start.cpu_ns};
+  }
+};
+
+//! Read the monotonic clock and the CPU clock of the calling thread.
+inline Timing read_clock() {
+  const auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch());
+#if defined(CATAPLASM_POSIX) && defined(CLOCK_THREAD_CPUTIME_ID)
+  timespec cpu;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  const uint64_t cpu_ns = cpu.tv_sec * 1000000000ull + cpu.tv_nsec;
+#else
+  const uint64_t cpu_ns = std::clock() * (1000000000ull / CLOCKS_PER_SEC);
+#endif
+  return {static_cast<uint64_t>(wall.count()), cpu_ns};
+}
+
+//! Convert nanoseconds to seconds.
+inline double seconds(uint64_t ns) { return ns / 1e9; }
+
+//! Describe a block which ran past its time limit, at the given path.
+inline std::string format_timeout(uint64_t timeout_ns,
+                                  const std::string &path) {
+  std::ostringstream os;
+  os << "timed out after " << seconds(timeout_ns) << " s, in " << path;
+  return os.str();
+}
+
+//----[ Allocations ]-----------------------------------------------------------
+//! Describe a count of allocations and their total size.
+inline std::string format_allocations(const AllocationStats &stats) {
+  return std::to_string(stats.count) +
+         (stats.count == 1 ? " allocation of " : " allocations of ") +
+         std::to_string(stats.bytes) + " bytes";
+}
+
+//! Header placed before each tracked allocation, keeping its alignment.
+union AllocationHeader {
+  struct {
+    size_t size;     //<! Bytes requested.
+    uint32_t offset; //<! Bytes from the start of the malloc() memory.
+    bool counted;    //<! If the allocation was counted.
+  } info;
+  std::max_align_t align;
+};
+
+/** Allocate `size` bytes aligned to `alignment`, a power of two, after a
+ *  header recording the size, and count the allocation if it is being
+ *  measured. Returns null on failure.
+ */
+inline void *allocate_tracked(size_t size,
+                              size_t alignment = alignof(AllocationHeader)) {
+  alignment = std::max(alignment, alignof(AllocationHeader));
+  const size_t padding = alignment - alignof(AllocationHeader);
+  auto start = reinterpret_cast<uintptr_t>(
+      std::malloc(sizeof(AllocationHeader) + padding + size));
+  if (!start) {
+    return nullptr;
+  }
+  const uintptr_t ptr =
+      (start + sizeof(AllocationHeader) + padding) & ~(alignment - 1);
+  auto *header =
+      reinterpret_cast<AllocationHeader *>(ptr - sizeof(AllocationHeader));
+  AllocationCounters &counters = allocation_counters();
+  header->info.size = size;
+  header->info.offset = static_cast<uint32_t>(ptr - start);
+  header->info.counted = counters.scopes > 0 && counters.paused == 0;
+  if (header->info.counted) {
+    ++counters.count;
+    counters.bytes += size;
+    counters.live += size;
+    counters.peak = std::max(counters.peak, counters.live);
+  }
+  return reinterpret_cast<void *>(ptr);
+}
+
+/** Allocate as allocate_tracked(), calling the new handler until it
+ *  succeeds, and throwing std::bad_alloc if there is no handler.
+ */
+inline void *new_tracked(size_t size,
+                         size_t alignment = alignof(AllocationHeader)) {
+  for (;;) {
+    if (void *ptr = allocate_tracked(size, alignment)) {
+      return ptr;
+    }
+    const std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+//! Free memory returned by allocate_tracked().
+inline void free_tracked(void *ptr) {
+  if (!ptr) {
+    return;
+  }
+  // Step back to the header through an integer, as compilers which inline
+  // this into operator delete otherwise see an out-of-bounds subscript.
+  const auto address = reinterpret_cast<uintptr_t>(ptr);
+  auto *header =
+      reinterpret_cast<AllocationHeader *>(address - sizeof(AllocationHeader));
+  if (header->info.counted) {
+    allocation_counters().live -= header->info.size;
+  }
+  std::free(reinterpret_cast<void *>(address - header->info.offset));
+}
+
+//----[ Performance counters ]--------------------------------------------------
+/** Describe the counts of the events in the mask `events`, divided by
+ *  `per`, with the instructions per cycle if both were counted.
+ */
+inline std::string format_perf(const PerfCounts &counts, uint32_t events,
+                               double per = 1.0) {
+  static const char *const names[PerfCounts::NUM_EVENTS] = {
+      "cycles", "instructions", "cache misses", "branch misses"};
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(per == 1.0 ? 0 : 2);
+  const char *separator = "";
+  for (uint32_t event = 0; event < PerfCounts::NUM_EVENTS; ++event) {
+    if (events & (1u << event)) {
+      os << separator << counts.values[event] / per << " " << names[event];
+      separator = ", ";
+    }
+    if (event == PerfCounts::INSTRUCTIONS && (events & 3u) == 3u &&
+        counts.values[PerfCounts::CYCLES] > 0) {
+      os << " (IPC " << std::setprecision(2)
+         << static_cast<double>(counts.values[PerfCounts::INSTRUCTIONS]) /
+                counts.values[PerfCounts::CYCLES]
+         << ")" << std::setprecision(per == 1.0 ? 0 : 2);
+    }
+  }
+  return os.str();
+}
+
+/** Hardware counters of the calling thread, counting in user space only.
+ *  The counters are opened as one group on first use in each thread and
+ *  process; events which cannot be opened, for lack of permission or of a
+ *  PMU, are left out.
+ */
+class PerfCounters {
+public:
+  PerfCounters() : fds_{-1, -1, -1, -1}, order_{}, pid_{0}, events_{0} {}
+  ~PerfCounters() { close_all(); }
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  //! Return the counters of the calling thread.
+  static PerfCounters &local() {
+    static thread_local PerfCounters counters;
+    return counters;
+  }
+
+  //! Return the mask of the events counted, or 0 if none could be opened.
+  uint32_t events() {
+    open();
+    return events_;
+  }
+
+  //! Read the running counts; no event is counted on failure.
+  PerfCounts read() {
+    PerfCounts counts{};
+#ifdef CATAPLASM_PERF_EVENTS
+    open();
+    if (events_ == 0) {
+      return counts;
+    }
+    // The number of events and the times enabled and running, then counts.
+    uint64_t data[3 + PerfCounts::NUM_EVENTS] = {};
+    const ssize_t size = ::read(fds_[order_[0]], data, sizeof(data));
+    if (size < static_cast<ssize_t>(3 * sizeof(uint64_t))) {
+      return counts;
+    }
+    counts.enabled_ns = data[1];
+    counts.running_ns = data[2];
+    for (uint64_t i = 0; i < data[0] && i < PerfCounts::NUM_EVENTS; ++i) {
+      counts.values[order_[i]] = data[3 + i];
+    }
+#endif
+    return counts;
+  }
+
+private:
+  //! Open the group, unless it is open in this process.
+  void open() {
+#ifdef CATAPLASM_PERF_EVENTS
+    if (pid_ == getpid()) {
+      return;
+    }
+    // Counters inherited across fork() measure the parent thread.
+    close_all();
+    pid_ = getpid();
+    static const uint64_t configs[PerfCounts::NUM_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    uint32_t opened = 0;
+    for (uint32_t event = 0; event < PerfCounts::NUM_EVENTS; ++event) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[event];
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      const int leader = opened == 0 ? -1 : fds_[order_[0]];
+      const long fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+      if (fd >= 0) {
+        fds_[event] = static_cast<int>(fd);
+        order_[opened++] = event;
+        events_ |= 1u << event;
+      }
+    }
+#endif
+  }
+
+  void close_all() {
+#ifdef CATAPLASM_PERF_EVENTS
+    for (int &fd : fds_) {
+      if (fd >= 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+#endif
+    events_ = 0;
+  }
+
+  int fds_[PerfCounts::NUM_EVENTS];        //<! Descriptor of each event, or -1.
+  uint32_t order_[PerfCounts::NUM_EVENTS]; //<! Events in order of opening.
+  long pid_;                               //<! Process which opened the group.
+  uint32_t events_;                        //<! Mask of the events opened.
+};
+
+//! Hash a string with 64-bit FNV-1a, which is stable across platforms.
+inline uint64_t hash_string(StringRef string) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : string) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+  }
+  return hash;
+}
+
+/** Read a timings file, in which each line holds a duration in seconds
+ *  followed by the name of a block.
+ */
+inline bool read_timings(const char *path,
+                         std::unordered_map<std::string, double> &timings) {
+  std::ifstream file{path};
+  if (!file) {
+    return false;
+  }
+  std::string line, name;
+  while (std::getline(file, line)) {
+    std::istringstream fields{line};
+    double seconds;
+    if (fields >> seconds && std::getline(fields >> std::ws, name) &&
+        !name.empty()) {
+      timings[name] = seconds;
+    }
+  }
+  return true;
+}
+
+//----[ Result cache ]----------------------------------------------------------
+//! The result of a block in an earlier run, from the result cache.
+struct CachedResult {
+  std::string build; //<! ID of the build which ran the block, or "unknown".
+  bool passed;       //<! If the block passed.
+  double seconds;    //<! Wall time of the block.
+};
+
+/** Read a result cache, in which each line holds a build ID, P or F, a
+ *  duration in seconds and the name of a block. A missing file is empty.
+ */
+inline void read_cache(const std::string &path,
+                       std::unordered_map<std::string, CachedResult> &cache) {
+  std::ifstream file{path};
+  std::string line, name;
+  while (std::getline(file, line)) {
+    std::istringstream fields{line};
+    CachedResult result;
+    std::string status;
+    if (fields >> result.build >> status >> result.seconds &&
+        std::getline(fields >> std::ws, name) && !name.empty()) {
+      result.passed = status == "P";
+      cache[name] = result;
+    }
+  }
+}
+
+#ifdef CATAPLASM_ELF_BUILD_ID
+/** Append the GNU build ID note of the main program, the first object
+ *  listed by dl_iterate_phdr, to the string at `data` in hex.
+ */
+inline int find_build_id(dl_phdr_info *info, size_t, void *data) {
+  std::string &id = *static_cast<std::string *>(data);
+  for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr) &segment = info->dlpi_phdr[i];
+    if (segment.p_type != PT_NOTE) {
+      continue;
+    }
+    const char *note =
+        reinterpret_cast<const char *>(info->dlpi_addr + segment.p_vaddr);
+    const char *const end = note + segment.p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+      const auto *header = reinterpret_cast<const ElfW(Nhdr) *>(note);
+      const char *name = note + sizeof(ElfW(Nhdr));
+      const char *desc = name + ((header->n_namesz + 3) & ~3u);
+      if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 &&
+          std::memcmp(name, "GNU", 4) == 0) {
+        static const char digits[] = "0123456789abcdef";
+        for (ElfW(Word) byte = 0; byte < header->n_descsz; ++byte) {
+          const unsigned char value = desc[byte];
+          id += digits[value >> 4];
+          id += digits[value & 15];
+        }
+        return 1;
+      }
+      note = desc + ((header->n_descsz + 3) & ~3u);
+    }
+  }
+  return 1;
+}
+#endif
+
+/** Return an ID of the running build: the GNU build ID recorded by the
+ *  linker where there is one, or else the size and modification time of
+ *  the executable at `exe_path`. Returns an empty string if neither is
+ *  available.
+ */
+inline std::string build_id(const char *exe_path) {
+  std::string id;
+#ifdef CATAPLASM_ELF_BUILD_ID
+  dl_iterate_phdr(&find_build_id, &id);
+  if (!id.empty()) {
+    return id;
+  }
+#endif
+#ifdef CATAPLASM_POSIX
+  struct stat info;
+  if (exe_path && stat(exe_path, &info) == 0) {
+    return std::to_string(info.st_size) + "-" + std::to_string(info.st_mtime);
+  }
+#else
+  (void)exe_path;
+#endif
+  return id;
+}
+
+//----[ Benchmark statistics ]--------------------------------------------------
+//! Statistics of the time per iteration of a benchmark, in nanoseconds.
+struct BenchmarkStats {
+  double mean;
+  double median;
+  double stddev;
+  double min;
+  double median_low;   //<! Lower bound of the 95% CI of the median.
+  double median_high;  //<! Upper bound of the 95% CI of the median.
+  uint64_t iterations; //<! Iterations per sample.
+  uint32_t samples;    //<! Number of samples.
+  uint32_t outliers;   //<! Samples outside the Tukey fences (1.5 IQR).
+  PerfCounts perf;     //<! Hardware events over the samples, if counted.
+};
+
+//! Return the value at quantile `q` of sorted samples, interpolating.
+inline double quantile(const std::vector<double> &sorted, double q) {
+  const double pos = q * (sorted.size() - 1);
+  const size_t below = static_cast<size_t>(pos);
+  if (below + 1 >= sorted.size()) {
+    return sorted.back();
+  }
+  return sorted[below] + (pos - below) * (sorted[below + 1] - sorted[below]);
+}
+
+//! Summarise samples of the time per iteration.
+inline BenchmarkStats analyse_samples(std::vector<double> samples,
+                                      uint64_t iterations) {
+  BenchmarkStats stats{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, iterations,
+                       static_cast<uint32_t>(samples.size()), 0, PerfCounts{}};
+  if (samples.empty()) {
+    return stats;
+  }
+  std::sort(samples.begin(), samples.end());
+  double sum = 0.0;
+  for (const double sample : samples) {
+    sum += sample;
+  }
+  stats.mean = sum / samples.size();
+  double squares = 0.0;
+  for (const double sample : samples) {
+    squares += (sample - stats.mean) * (sample - stats.mean);
+  }
+  stats.stddev =
+      samples.size() > 1 ? std::sqrt(squares / (samples.size() - 1)) : 0.0;
+  stats.median = quantile(samples, 0.5);
+  stats.min = samples.front();
+  // Distribution-free CI of the median: the order statistics whose ranks
+  // bound the binomial(n, 1/2) count of samples below it, at 95%.
+  const double n = samples.size(), spread = 1.96 * std::sqrt(n) / 2.0;
+  const double low_rank = std::floor(n / 2.0 - spread);
+  const double high_rank = std::ceil(n / 2.0 + spread);
+  stats.median_low = samples[low_rank < 1.0 ? 0 : size_t(low_rank) - 1];
+  stats.median_high =
+      samples[high_rank >= n ? samples.size() - 1 : size_t(high_rank)];
+  const double q1 = quantile(samples, 0.25), q3 = quantile(samples, 0.75);
+  const double fence = 1.5 * (q3 - q1);
+  for (const double sample : samples) {
+    if (sample < q1 - fence || sample > q3 + fence) {
+      ++stats.outliers;
+    }
+  }
+  return stats;
+}
+
+//! Format a duration in nanoseconds with a suitable unit.
+inline std::string format_ns(double ns) {
+  static const char *const units[] = {"ns", "us", "ms", "s"};
+  size_t unit = 0;
+  while (unit < 3 && std::fabs(ns) >= 1000.0) {
+    ns /= 1000.0;
+    ++unit;
+  }
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(3) << ns << " " << units[unit];
+  return os.str();
+}
+
+//! The median of a benchmark from a baseline file, with its 95% CI.
+struct Baseline {
+  double median;
+  double low;
+  double high;
+};
+
+/** Read a baseline file, in which each line holds the median and the bounds
+ *  of its confidence interval in nanoseconds, followed by the name of a
+ *  block and benchmark separated by " / ".
+ */
+inline bool read_baseline(const char *path,
+                          std::unordered_map<std::string, Baseline> &baseline) {
+  std::ifstream file{path};
+  if (!file) {
+    return false;
+  }
+  std::string line, name;
+  while (std::getline(file, line)) {
+    std::istringstream fields{line};
+    Baseline entry;
+    if (fields >> entry.median >> entry.low >> entry.high &&
+        std::getline(fields >> std::ws, name) && !name.empty()) {
+      baseline[name] = entry;
+    }
+  }
+  return true;
+}
+
+//! The statistics of a benchmark run, and the nodes it belongs to.
+struct BenchmarkResult {
+  uint32_t block; //<! Index of the enclosing block.
+  uint32_t node;  //<! Index of the benchmark's node.
+  BenchmarkStats stats;
+};
+
+//----[ Tags ]------------------------------------------------------------------
+//! A set of tags, as a bitset of the IDs they are interned to.
+class TagSet {
+public:
+  void insert(uint32_t id) {
+    if (id / 64 >= words_.size()) {
+      words_.resize(id / 64 + 1, 0);
+    }
+    words_[id / 64] |= uint64_t(1) << (id % 64);
+  }
+
+  //! Return true if the sets have a tag in common.
+  bool intersects(const TagSet &other) const {
+    const size_t size = std::min(words_.size(), other.words_.size());
+    for (size_t word = 0; word < size; ++word) {
+      if (words_[word] & other.words_[word]) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  std::vector<uint64_t> words_;
+};
+
+/** A boolean expression over tags, such as "fast & !slow | (net & smoke)",
+ *  compiled to a postfix program. `!` binds tightest, then `&`, then `|`,
+ *  then `;`, which separates a list of tags. Each tag is resolved when
+ *  compiled to the set of interned tags it matches, so a tag with * and ?
+ *  wildcards costs no more to test than a plain one.
+ */
+class TagExpression {
+public:
+  //! Resolves a tag, which may contain wildcards, to the tags it matches.
+  using resolve_fn = std::function<TagSet(StringRef)>;
+
+  TagExpression()
+      : ops_{}, depth_{0}, max_depth_{0}, nesting_{0}, any_{true},
+        resolve_{nullptr} {}
+
+  /** Compile `text` and AND it with the expression so far. `;` means `|` if
+   *  `any` is set, as for -t, or `&`, as for -x.
+   */
+  ExprResult compile(const char *text, bool any, const resolve_fn &resolve) {
+    const size_t start = ops_.size();
+    const int32_t start_depth = depth_, start_max_depth = max_depth_;
+    nesting_ = 0;
+    any_ = any;
+    resolve_ = &resolve;
+    const char *pos = text;
+    std::string error = parse_list(pos);
+    if (error.empty() && *pos != '\0') {
+      error = std::string("unexpected '") + *pos + "'";
+    }
+    if (error.empty() && max_depth_ > MAX_DEPTH) {
+      error = "nested too deeply";
+    }
+    if (!error.empty()) {
+      ops_.erase(ops_.begin() + start, ops_.end());
+      depth_ = start_depth;
+      max_depth_ = start_max_depth;
+      return {false, "Invalid tag expression '" + std::string(text) +
+                         "': " + error + "!"};
+    }
+    if (start > 0) {
+      push(OpKind::And);
+    }
+    return {true, ""};
+  }
+
+  bool empty() const { return ops_.empty(); }
+
+  //! Evaluate the expression for a block with the given tags.
+  bool matches(const TagSet &tags) const {
+    bool stack[MAX_DEPTH];
+    uint32_t depth = 0;
+    for (const Op &op : ops_) {
+      switch (op.kind) {
+      case OpKind::Match:
+        stack[depth++] = tags.intersects(op.tags);
+        break;
+      case OpKind::Not:
+        stack[depth - 1] = !stack[depth - 1];
+        break;
+      case OpKind::And:
+        --depth;
+        stack[depth - 1] = stack[depth - 1] && stack[depth];
+        break;
+      case OpKind::Or:
+        --depth;
+        stack[depth - 1] = stack[depth - 1] || stack[depth];
+        break;
+      }
+    }
+    return stack[0];
+  }
+
+private:
+  enum : int32_t { MAX_DEPTH = 64 };
+  enum class OpKind : uint8_t { Match, Not, And, Or };
+
+  struct Op {
+    OpKind kind;
+    TagSet tags; //<! Tags matched, for OpKind::Match.
+  };
+
+  static bool is_space(char c) { return c == ' ' || c == '\t'; }
+
+  static const char *skip_space(const char *pos) {
+    while (is_space(*pos)) {
+      ++pos;
+    }
+    return pos;
+  }
+
+  //! Append an operation, tracking the depth of the evaluation stack.
+  void push(OpKind kind, TagSet tags = {}) {
+    depth_ += kind == OpKind::Match ? 1 : (kind == OpKind::Not ? 0 : -1);
+    max_depth_ = std::max(max_depth_, depth_);
+    ops_.push_back(Op{kind, std::move(tags)});
+  }
+
+  //! Parse a list separated by `;`; empty items are skipped.
+  std::string parse_list(const char *&pos) {
+    for (pos = skip_space(pos); *pos == ';';) {
+      pos = skip_space(pos + 1);
+    }
+    std::string error = parse_or(pos);
+    while (error.empty() && *pos == ';') {
+      pos = skip_space(pos + 1);
+      if (*pos == '\0' || *pos == ';' || *pos == ')') {
+        continue;
+      }
+      error = parse_or(pos);
+      if (error.empty()) {
+        push(any_ ? OpKind::Or : OpKind::And);
+      }
+    }
+    return error;
+  }
+
+  std::string parse_or(const char *&pos) {
+    std::string error = parse_and(pos);
+    while (error.empty() && *pos == '|') {
+      error = parse_and(++pos);
+      if (error.empty()) {
+        push(OpKind::Or);
+      }
+    }
+    return error;
+  }
+
+  std::string parse_and(const char *&pos) {
+    std::string error = parse_not(pos);
+    while (error.empty() && *pos == '&') {
+      error = parse_not(++pos);
+      if (error.empty()) {
+        push(OpKind::And);
+      }
+    }
+    return error;
+  }
+
+  /** Parse a tag, a parenthesised list, or the negation of either. Each
+   *  `!` and `(` recurses, so their nesting is limited like the stack.
+   */
+  std::string parse_not(const char *&pos) {
+    pos = skip_space(pos);
+    if ((*pos == '!' || *pos == '(') && nesting_ >= MAX_DEPTH) {
+      return "nested too deeply";
+    }
+    if (*pos == '!') {
+      ++nesting_;
+      std::string error = parse_not(++pos);
+      --nesting_;
+      if (error.empty()) {
+        push(OpKind::Not);
+      }
+      return error;
+    }
+    if (*pos == '(') {
+      ++nesting_;
+      std::string error = parse_list(++pos);
+      --nesting_;
+      if (error.empty() && *pos != ')') {
+        error = "expected ')'";
+      }
+      if (error.empty()) {
+        pos = skip_space(pos + 1);
+      }
+      return error;
+    }
+    const char *start = pos;
+    while (*pos != '\0' && !is_space(*pos) && !std::strchr(";|&!()", *pos)) {
+      ++pos;
+    }
+    if (pos == start) {
+      return *pos == '\0' ? "expected a tag"
+                           : std::string("unexpected '") + *pos + "'";
+    }
+    push(OpKind::Match,
+         (*resolve_)(StringRef{start, static_cast<size_t>(pos - start)}));
+    pos = skip_space(pos);
+    return "";
+  }
+
+  std::vector<Op> ops_;
+  int32_t depth_;     //<! Depth of the evaluation stack at the end.
+  int32_t max_depth_; //<! Greatest depth of the evaluation stack.
+  int32_t nesting_;   //<! Depth of `!` and `(` being parsed.
+  bool any_;          //<! If `;` means `|`, while compiling.
+  const resolve_fn *resolve_; //<! Resolver, while compiling.
+};
+
+//----[ TestNode ]--------------------------------------------------------------
+struct TestNode {
+  TestNode(NodeType type, Status status, StringRef expr, uint32_t line,
+           StringRef source = {}, payload_fn fn = nullptr)
+      : payload{fn}, expr{expr}, source{source}, tags_begin{0}, tags_end{0},
+        time{0, 0}, rerun_ns{0}, saved_ns{0}, allocations{0, 0, 0}, perf{},
+        line{line}, type{type}, status{status}, new_run{false}, children_{} {}
+
+  void push_child(uint32_t index) { children_.emplace_back(index); }
+  //! Forget and free all children.
+  void release_children() { std::vector<uint32_t>().swap(children_); }
+  //! Shift the indices of all children, when moving nodes between referees.
+  void offset_children(uint32_t offset) {
+    for (auto &child : children_) {
+      child += offset;
+    }
+  }
+  auto begin() const -> std::vector<uint32_t>::const_iterator {
+    return children_.begin();
+  }
+  auto end() const -> std::vector<uint32_t>::const_iterator {
+    return children_.end();
+  }
+  bool empty() const { return children_.empty(); }
+
+  payload_fn payload; //<! The test function, if this is a test block.
+  StringRef expr; //<! The name or string representation of the expression.
+  /** Source text of a test, the file of a block, or, for a section made by a
+   *  generated value or a PROPERTY counterexample, the macro which made it.
+   */
+  StringRef source;
+  uint32_t tags_begin; //<! Start of this block's tags in the TestReferee.
+  uint32_t tags_end;   //<! End of this block's tags in the TestReferee.
+  Timing time;         //<! Time taken by this block or section run.
+  uint64_t rerun_ns;   //<! Wall time spent re-running code above sections.
+  uint64_t saved_ns;   //<! Wall time of fixture setup not re-run per leaf.
+  AllocationStats allocations; //<! Allocations of this block or section run.
+  PerfCounts perf;     //<! Hardware events counted over this block.
+  uint32_t line;       //<! The line this TestNode was invoked from.
+  NodeType type;                 //<! The type of this TestNode.
+  Status status; //<! Whether or not the test expression evaluated true.
+  bool new_run;  //<! If this node is the beginning of a new run.
+private:
+  std::vector<uint32_t>
+      children_; //<! Indices of child nodes within the TestReferee.
+};
+
+//----[ PassSite ]--------------------------------------------------------------
+//! Count of the passing tests invoked from one line of a block or section.
+struct PassSite {
+  uint32_t container; //<! Index of the enclosing block or section.
+  uint32_t line;      //<! The line the tests were invoked from.
+  NodeType type;      //<! The type of the first test counted.
+  uint64_t count;     //<! Number of tests which passed.
+};
+
+//! Check if a path starts with the given prefix.
+inline bool has_prefix(const std::vector<PathStep> &path,
+                       const std::vector<PathStep> &prefix) {
+  return path.size() >= prefix.size() &&
+         std::equal(prefix.begin(), prefix.end(), path.begin());
+}
+
+//----[ BlockRun ]--------------------------------------------------------------
+//! The nodes and counts produced by running one block in its own referee.
+struct BlockRun {
+  //! Append a binary representation of the run to `out`.
+  void serialize(std::string &out) const {
+    write_pod(out, static_cast<uint32_t>(nodes.size()));
+    for (const auto &node : nodes) {
+      write_pod(out, node.type);
+      write_pod(out, node.status);
+      write_pod(out, node.new_run);
+      write_pod(out, node.line);
+      write_pod(out, node.time);
+      write_pod(out, node.rerun_ns);
+      write_pod(out, node.saved_ns);
+      write_pod(out, node.allocations);
+      write_pod(out, node.perf);
+      write_text(out, node.expr);
+      write_text(out, node.source);
+      write_pod(out, static_cast<uint32_t>(node.end() - node.begin()));
+      for (auto child : node) {
+        write_pod(out, child);
+      }
+    }
+    write_pods(out, pass_sites);
+    write_pods(out, benchmarks);
+  }
+
+  /** Rebuild a run written by serialize(). Node 0 is replaced by a copy of
+   *  `block`. Returns false if the data is malformed.
+   */
+  bool deserialize(const TestNode &block, const char *data, size_t size) {
+    const char *const end = data + size;
+    uint32_t num_nodes = 0;
+    if (!read_pod(data, end, num_nodes) || num_nodes == 0) {
+      return false;
+    }
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+      NodeType type;
+      Status status;
+      bool new_run;
+      uint32_t line, num_children;
+      Timing time;
+      uint64_t rerun_ns, saved_ns;
+      AllocationStats allocations;
+      PerfCounts perf;
+      StringRef expr, source;
+      if (!read_pod(data, end, type) || !read_pod(data, end, status) ||
+          !read_pod(data, end, new_run) || !read_pod(data, end, line) ||
+          !read_pod(data, end, time) || !read_pod(data, end, rerun_ns) ||
+          !read_pod(data, end, saved_ns) ||
+          !read_pod(data, end, allocations) || !read_pod(data, end, perf) ||
+          !read_text(data, end, expr) || !read_text(data, end, source) ||
+          !read_pod(data, end, num_children)) {
+        return false;
+      }
+      if (i == 0) {
+        nodes.push_back(block);
+      } else {
+        nodes.emplace_back(type, status, expr, line, source);
+      }
+      nodes.back().new_run = new_run;
+      nodes.back().time = time;
+      nodes.back().rerun_ns = rerun_ns;
+      nodes.back().saved_ns = saved_ns;
+      nodes.back().allocations = allocations;
+      nodes.back().perf = perf;
+      for (uint32_t child = 0; child < num_children; ++child) {
+        uint32_t index;
+        if (!read_pod(data, end, index) || index >= num_nodes) {
+          return false;
+        }
+        nodes.back().push_child(index);
+      }
+    }
+    return read_pods(data, end, pass_sites) &&
+           read_pods(data, end, benchmarks) && data == end;
+  }
+
+  std::vector<TestNode> nodes; //<! The block, followed by its descendants.
+  std::vector<PassSite> pass_sites; //<! Passing tests, in compact mode.
+  std::vector<BenchmarkResult> benchmarks; //<! Results of benchmarks.
+  TextPool text; //<! Text referenced by the nodes.
+
+private:
+  template <typename T> static void write_pod(std::string &out, const T &pod) {
+    out.append(reinterpret_cast<const char *>(&pod), sizeof(T));
+  }
+  template <typename T>
+  static void write_pods(std::string &out, const std::vector<T> &pods) {
+    write_pod(out, static_cast<uint32_t>(pods.size()));
+    for (const auto &pod : pods) {
+      write_pod(out, pod);
+    }
+  }
+  static void write_text(std::string &out, StringRef text) {
+    write_pod(out, text.size);
+    out.append(text.data, text.size);
+  }
+  template <typename T>
+  static bool read_pod(const char *&data, const char *end, T &pod) {
+    if (static_cast<size_t>(end - data) < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&pod, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+  }
+  template <typename T>
+  static bool read_pods(const char *&data, const char *end,
+                        std::vector<T> &pods) {
+    uint32_t size = 0;
+    if (!read_pod(data, end, size) ||
+        static_cast<size_t>(end - data) / sizeof(T) < size) {
+      return false;
+    }
+    pods.resize(size);
+    for (auto &pod : pods) {
+      read_pod(data, end, pod);
+    }
+    return true;
+  }
+  bool read_text(const char *&data, const char *end, StringRef &text) {
+    uint32_t size;
+    if (!read_pod(data, end, size) || static_cast<size_t>(end - data) < size) {
+      return false;
+    }
+    text = this->text.store(StringRef{data, size});
+    data += size;
+    return true;
+  }
+};
+
+//----[ TaskPool ]--------------------------------------------------------------
+/** A work-stealing thread pool. Each worker takes tasks from the front of
+ *  its own queue and, when that is empty, steals from the back of the other
+ *  workers' queues. Tasks may push further tasks while the pool is running.
+ */
+class TaskPool {
+public:
+  using task_fn = std::function<void(unsigned)>; //<! Takes the worker index.
+
+  explicit TaskPool(unsigned num_workers)
+      : queues_(num_workers ? num_workers : 1), mutex_{}, idle_{}, queued_{0},
+        pending_{0} {}
+
+  unsigned size() const { return static_cast<unsigned>(queues_.size()); }
+
+  //! Queue a task for the given worker.
+  void push(task_fn task, unsigned worker = 0) {
+    Queue &queue = queues_[worker % queues_.size()];
+    {
+      std::lock_guard<std::mutex> lock{queue.mutex};
+      queue.tasks.emplace_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      ++queued_;
+      ++pending_;
+    }
+    idle_.notify_one();
+  }
+
+  //! Run queued tasks on all workers, returning once every task is done.
+  void run() {
+    std::vector<std::thread> threads;
+    for (unsigned worker = 1; worker < queues_.size(); ++worker) {
+      threads.emplace_back(&TaskPool::work, this, worker);
+    }
+    work(0);
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<task_fn> tasks;
+  };
+
+  //! Take a task from the worker's own queue, or steal one.
+  bool pop(unsigned worker, task_fn &task) {
+    const size_t num_queues = queues_.size();
+    for (size_t i = 0; i < num_queues; ++i) {
+      Queue &queue = queues_[(worker + i) % num_queues];
+      std::lock_guard<std::mutex> lock{queue.mutex};
+      if (queue.tasks.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      } else {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      }
+      std::lock_guard<std::mutex> count_lock{mutex_};
+      --queued_;
+      return true;
+    }
+    return false;
+  }
+
+  void work(unsigned worker) {
+    task_fn task;
+    for (;;) {
+      if (pop(worker, task)) {
+        task(worker);
+        task = nullptr;
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (--pending_ == 0) {
+          idle_.notify_all();
+        }
+        continue;
+      }
+      std::unique_lock<std::mutex> lock{mutex_};
+      idle_.wait(lock, [this] { return queued_ > 0 || pending_ == 0; });
+      if (pending_ == 0) {
+        return;
+      }
+    }
+  }
+
+  std::vector<Queue> queues_;   //<! One queue of tasks per worker.
+  std::mutex mutex_;            //<! Guards the task counts.
+  std::condition_variable idle_; //<! Signalled when tasks are queued or done.
+  size_t queued_;  //<! Tasks waiting in a queue.
+  size_t pending_; //<! Tasks queued or running.
+};
+
+//----[ Reporters ]-------------------------------------------------------------
+//! Totals of a run, for the final summary.
+struct RunTotals {
+  uint64_t tests;
+  uint64_t tests_failed;
+  uint64_t blocks;
+  uint64_t blocks_failed;
+  uint64_t benchmarks_regressed;
+};
+
+/** Receives the results of a run: each block in registration order once it
+ *  has finished, then the totals.
+ */
+class Reporter {
+public:
+  virtual ~Reporter() {}
+  //! Report a finished block; `nodes` holds the block and its descendants.
+  virtual void report_block(const std::vector<TestNode> &nodes,
+                            const TestNode &block) = 0;
+  //! Report the totals of the run, once every block has been reported.
+  virtual void report_totals(const RunTotals &totals) = 0;
+};
+
+//! The default Reporter, which prints a tree of results for people to read.
+class ConsoleReporter : public Reporter {
+public:
+  ConsoleReporter(std::ostream &out, bool verbose, bool expand_all)
+      : out_(out), nodes_{nullptr}, verbose_{verbose},
+        expand_all_{expand_all}, level_{0} {}
+
+  void report_block(const std::vector<TestNode> &nodes,
+                    const TestNode &block) override {
+    if (block.empty() || !(verbose_ || block.status == Status::Fail)) {
+      return;
+    }
+    nodes_ = &nodes;
+    level_ = 0;
+    describe_node(block);
+    enumerate_children(block);
+    out_ << "\n\n";
+  }
+
+  void report_totals(const RunTotals &totals) override {
+    if (totals.tests_failed == 0 && totals.benchmarks_regressed == 0) {
+      out_ << "------------------ " << Status::Succeed << "------------------"
+           << "\n\n";
+      out_ << CLIAttr::Green << "All " << totals.tests << " tests passed.\n";
+      out_ << "All " << totals.blocks << " blocks completed successfully.\n";
+      out_ << CLIAttr::Reset << '\n';
+    } else {
+      out_ << "------------------ " << Status::Fail << "------------------"
+           << "\n\n";
+      out_ << CLIAttr::Green << totals.tests - totals.tests_failed
+           << " tests passed.";
+      out_ << CLIAttr::Reset << " | " << CLIAttr::Red << totals.tests_failed
+           << " tests failed.\n";
+      if (totals.benchmarks_regressed > 0) {
+        out_ << CLIAttr::Red << totals.benchmarks_regressed
+             << " benchmarks regressed." << CLIAttr::Reset << '\n';
+      }
+      out_ << CLIAttr::Green << totals.blocks - totals.blocks_failed
+           << " blocks passed.";
+      out_ << CLIAttr::Reset << " | " << CLIAttr::Red << totals.blocks_failed
+           << " blocks failed.\n";
+      out_ << CLIAttr::Reset << '\n';
+    }
+  }
+
+private:
+  void draw_indent(const char *indent_str) const {
+    for (int i = 0; i < level_; ++i) {
+      out_ << indent_str;
+    }
+  }
+
+  //! Print the details of a TestNode.
+  void describe_node(const TestNode &node) const {
+    if (node.type == NodeType::Section) {
+      draw_indent("  ");
+    } else {
+      draw_indent("  ");
+      if (level_ != 0)
+        out_ << "| ";
+    }
+
+    switch (node.type) {
+    case NodeType::Block:
+      out_ << CLIAttr::Bold << "----------[ ";
+      out_ << node.expr << " ]----------";
+      describe_allocations(node);
+      break;
+    case NodeType::Section:
+      out_ << "\\- ";
+      out_ << ((node.status == Status::Succeed) ? CLIAttr::Green
+                                                : CLIAttr::Red);
+      out_ << CLIAttr::Bold << node.expr;
+      describe_allocations(node);
+      break;
+    case NodeType::Fail:
+      out_ << node.status;
+      out_ << CLIAttr::Red << "FAIL invoked" << CLIAttr::Reset;
+      if (!node.expr.empty()) {
+        out_ << ": " << node.expr;
+      }
+      break;
+    case NodeType::Pass:
+      out_ << node.status;
+      out_ << CLIAttr::Green << "PASS invoked" << CLIAttr::Reset;
+      if (!node.expr.empty()) {
+        out_ << ": " << node.expr;
+      }
+      break;
+    case NodeType::Notice:
+      out_ << CLIAttr::Reset << "NOTICE: " << node.expr;
+      break;
+    case NodeType::Warn:
+      out_ << CLIAttr::Red << "[ WARN ] " << node.expr;
+      out_ << CLIAttr::Reset;
+      break;
+    case NodeType::Throws:
+    case NodeType::ThrowsAs:
+      out_ << node.status;
+      out_ << "with expression " << node.type;
+      out_ << "(" << node.source << ") throwing \'" << node.expr << "\'";
+      out_ << ", line " << node.line;
+      break;
+    case NodeType::NoThrow:
+      out_ << node.status;
+      out_ << "without exception '" << node.expr;
+      out_ << "', line " << node.line;
+      break;
+    case NodeType::ThrowsUnexpected:
+      out_ << node.status;
+      out_ << "with unexpected exception '" << node.expr;
+      out_ << "', line " << node.line;
+      break;
+    case NodeType::ThrowsOutOfNode:
+      out_ << node.status;
+      out_ << "with unexpected exception '" << node.expr;
+      out_ << "', at some point after line " << node.line;
+      break;
+    case NodeType::Crash:
+      out_ << node.status;
+      out_ << "with worker process terminated by " << node.expr;
+      break;
+    case NodeType::Timeout:
+      out_ << node.status << node.expr;
+      break;
+    case NodeType::Benchmark:
+      out_ << node.status;
+      out_ << "with " << node.type << " '" << node.expr << "', line "
+           << node.line << '\n';
+      draw_indent("  ");
+      if (level_ != 0) {
+        out_ << "| ";
+      }
+      for (const char *line = node.source.begin(); line != node.source.end();) {
+        const char *line_end = std::find(line, node.source.end(), '\n');
+        out_ << "                         "
+             << StringRef{line, static_cast<uint32_t>(line_end - line)};
+        if (line_end == node.source.end()) {
+          break;
+        }
+        out_ << '\n';
+        draw_indent("  ");
+        if (level_ != 0) {
+          out_ << "| ";
+        }
+        line = line_end + 1;
+      }
+      break;
+    default:
+      out_ << node.status;
+      out_ << "with expression " << node.type;
+      out_ << "(" << node.source;
+      out_ << "), line " << node.line;
+      if (node.status == Status::Fail || expand_all_) {
+        out_ << '\n';
+        draw_indent("  ");
+        if (level_ != 0) {
+          out_ << "| ";
+        }
+        out_ << "                         '" << node.expr;
+        out_ << "'";
+      }
+      break;
+    }
+    out_ << CLIAttr::Reset << '\n';
+  }
+
+  //! In verbose mode, print the allocations of a block or section run.
+  void describe_allocations(const TestNode &node) const {
+    if (verbose_ && allocations_tracked()) {
+      out_ << CLIAttr::Reset << "  [" << format_allocations(node.allocations)
+           << ", peak " << node.allocations.peak_bytes << " bytes]";
+    }
+  }
+
+  /** Describe and enumerate the children of a node: all of them in verbose
+   *  mode, otherwise only those which failed.
+   */
+  void enumerate_children(const TestNode &node) {
+    for (auto iter = node.begin(); iter != node.end(); ++iter) {
+      auto &child_node = (*nodes_)[*iter];
+      if (verbose_ || child_node.status == Status::Fail) {
+        if (child_node.new_run) {
+          out_ << '\n';
+          level_ = 0;
+        }
+
+        describe_node(child_node);
+        if (child_node.type == NodeType::Section) {
+          ++level_;
+        }
+
+        enumerate_children(child_node);
+        if (child_node.type == NodeType::Section) {
+          --level_;
+        }
+      }
+    }
+  }
+
+  std::ostream &out_;
+  const std::vector<TestNode> *nodes_; //<! Nodes of the block being reported.
+  bool verbose_;    //<! Report every node, rather than only failures.
+  bool expand_all_; //<! Expand the operands of passing tests.
+  int level_;       //<! Nested section depth.
+};
+
+//! Write text escaped for XML attributes and character data.
+inline void write_xml(std::ostream &out, StringRef text) {
+  for (const char c : text) {
+    switch (c) {
+    case '<':
+      out << "&lt;";
+      break;
+    case '>':
+      out << "&gt;";
+      break;
+    case '&':
+      out << "&amp;";
+      break;
+    case '"':
+      out << "&quot;";
+      break;
+    case '\n':
+      out << "&#10;";
+      break;
+    default:
+      // control characters are not allowed in XML 1.0
+      out << (static_cast<unsigned char>(c) < 0x20 && c != '\t' ? '?' : c);
+    }
+  }
+}
+
+//! Write text as a quoted JSON string.
+inline void write_json(std::ostream &out, StringRef text) {
+  out << '"';
+  for (const char c : text) {
+    switch (c) {
+    case '"':
+      out << "\\\"";
+      break;
+    case '\\':
+      out << "\\\\";
+      break;
+    case '\n':
+      out << "\\n";
+      break;
+    case '\t':
+      out << "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        static const char *const hex = "0123456789abcdef";
+        out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+      } else {
+        out << c;
+      }
+    }
+  }
+  out << '"';
+}
+
+/** Writes a JUnit XML report, with a <testsuite> for each block and a
+ *  <testcase> for each block or section run which holds tests. The file is
+ *  flushed after each block, and is complete once the totals are reported.
+ */
+class JUnitReporter : public Reporter {
+public:
+  explicit JUnitReporter(std::ostream &out) : out_(out), cases_{} {
+    out_ << std::setprecision(9);
+    out_ << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n";
+    out_.flush();
+  }
+
+  void report_block(const std::vector<TestNode> &nodes,
+                    const TestNode &block) override {
+    cases_.clear();
+    collect_cases(nodes, block, block.expr.str());
+    size_t failures = 0;
+    for (const auto &test_case : cases_) {
+      failures += test_case.container->status == Status::Fail;
+    }
+    out_ << "  <testsuite name=\"";
+    write_xml(out_, block.expr);
+    out_ << "\" tests=\"" << cases_.size() << "\" failures=\"" << failures
+         << "\" time=\"" << seconds(block.time.wall_ns) << "\">\n";
+    for (const auto &test_case : cases_) {
+      out_ << "    <testcase classname=\"";
+      write_xml(out_, block.expr);
+      out_ << "\" name=\"";
+      write_xml(out_, StringRef{test_case.path.data(), test_case.path.size()});
+      out_ << "\" time=\"" << seconds(test_case.container->time.wall_ns)
+           << "\">\n";
+      for (const auto child : *test_case.container) {
+        const TestNode &node = nodes[child];
+        if (!is_container(node.type) && node.status == Status::Fail) {
+          write_failure(node);
+        }
+      }
+      out_ << "    </testcase>\n";
+    }
+    out_ << "  </testsuite>\n";
+    out_.flush();
+  }
+
+  void report_totals(const RunTotals &) override {
+    out_ << "</testsuites>\n";
+    out_.flush();
+  }
+
+private:
+  //! A container which holds tests, and its path from the block.
+  struct Case {
+    const TestNode *container;
+    std::string path;
+  };
+
+  //! Add a case for each container holding tests or having no sections.
+  void collect_cases(const std::vector<TestNode> &nodes,
+                     const TestNode &container, const std::string &path) {
+    bool has_tests = false, has_sections = false;
+    for (const auto child : container) {
+      const bool is_section = nodes[child].type == NodeType::Section;
+      has_sections |= is_section;
+      has_tests |= !is_section;
+    }
+    if (has_tests || !has_sections) {
+      cases_.push_back(Case{&container, path});
+    }
+    for (const auto child : container) {
+      if (nodes[child].type == NodeType::Section) {
+        collect_cases(nodes, nodes[child],
+                      path + " / " + nodes[child].expr.str());
+      }
+    }
+  }
+
+  void write_failure(const TestNode &node) {
+    out_ << "      <failure type=\"" << node.type << "\" message=\"";
+    write_xml(out_, node.expr);
+    out_ << "\">" << node.type;
+    if (!node.source.empty()) {
+      out_ << "(";
+      write_xml(out_, node.source);
+      out_ << ")";
+    }
+    out_ << ", line " << node.line << "</failure>\n";
+  }
+
+  std::ostream &out_;
+  std::vector<Case> cases_; //<! Cases of the block being reported.
+};
+
+/** Writes a JSON Lines report: one object per block, holding its tree of
+ *  recorded nodes, then one holding the totals. Each line is flushed as it
+ *  is written, so the file can be read while the run continues.
+ */
+class JsonReporter : public Reporter {
+public:
+  explicit JsonReporter(std::ostream &out) : out_(out) {
+    out_ << std::setprecision(9);
+  }
+
+  void report_block(const std::vector<TestNode> &nodes,
+                    const TestNode &block) override {
+    out_ << "{\"block\":";
+    write_json(out_, block.expr);
+    out_ << ",\"line\":" << block.line << ",\"status\":\""
+         << status_name(block.status) << "\"";
+    write_times(block);
+    out_ << ",\"rerun_s\":" << seconds(block.rerun_ns)
+         << ",\"saved_s\":" << seconds(block.saved_ns);
+    write_children(nodes, block);
+    out_ << "}\n";
+    out_.flush();
+  }
+
+  void report_totals(const RunTotals &totals) override {
+    out_ << "{\"totals\":{\"tests\":" << totals.tests
+         << ",\"tests_failed\":" << totals.tests_failed
+         << ",\"blocks\":" << totals.blocks
+         << ",\"blocks_failed\":" << totals.blocks_failed
+         << ",\"benchmarks_regressed\":" << totals.benchmarks_regressed
+         << "}}\n";
+    out_.flush();
+  }
+
+private:
+  static const char *status_name(Status status) {
+    return status == Status::Succeed ? "pass"
+                                     : status == Status::Fail ? "fail" : "none";
+  }
+
+  void write_times(const TestNode &node) {
+    out_ << ",\"wall_s\":" << seconds(node.time.wall_ns)
+         << ",\"cpu_s\":" << seconds(node.time.cpu_ns);
+  }
+
+  void write_children(const std::vector<TestNode> &nodes,
+                      const TestNode &container) {
+    out_ << ",\"children\":[";
+    for (auto child = container.begin(); child != container.end(); ++child) {
+      if (child != container.begin()) {
+        out_ << ",";
+      }
+      write_node(nodes, nodes[*child]);
+    }
+    out_ << "]";
+  }
+
+  //! Write a section with its children, or a test with its expansion.
+  void write_node(const std::vector<TestNode> &nodes, const TestNode &node) {
+    out_ << "{\"type\":\"" << node.type << "\",\"status\":\""
+         << status_name(node.status) << "\",\"line\":" << node.line;
+    if (is_container(node.type)) {
+      out_ << ",\"name\":";
+      write_json(out_, node.expr);
+      write_times(node);
+      write_children(nodes, node);
+    } else {
+      out_ << ",\"expression\":";
+      write_json(out_, node.source);
+      out_ << ",\"expansion\":";
+      write_json(out_, node.expr);
+    }
+    out_ << "}";
+  }
+
+  std::ostream &out_;
+};
+
+//----[ Test Referee ]----------------------------------------------------------
+class TestReferee;
+inline TestReferee *&thread_referee();
+
+class TestReferee {
+  enum class CacheSelect { All, LastFailed, OnlyChanged };
+  enum class BlockOrder { Declaration, Random, LongestFirst };
+  enum class ListMode { None, Tests, Tags };
+  enum : size_t { PROGRESS_BYTES = 4096 }; //<! Size of shared_progress_.
+
+  //! Start of a section run, for timing.
+  struct SectionTimer {
+    uint32_t node;    //<! Index of the section's node.
+    uint32_t entered; //<! Sections entered in the block, including this one.
+    Timing start;     //<! Clock reading on entry.
+    AllocationMark allocations; //<! Allocation counts on entry.
+  };
+
+public:
+  TestReferee()
+      : nodes_{}, tags_{}, tag_ids_{}, tag_names_{}, block_tags_{}, text_{},
+        names_{}, tag_filter_{}, select_path_{}, node_stack_{},
+        section_stack_{}, next_section_{}, run_prefix_{}, split_values_{},
+        section_timers_{}, pass_sites_{}, site_index_{}, benchmarks_{},
+        benchmark_names_{}, slowest_sections_{}, totals_{}, num_blocks_{0},
+        shard_timings_{}, timings_path_{}, block_times_{}, rerun_ns_{0},
+        saved_ns_{0}, fixture_ns_{0}, fixture_{}, leaf_ns_{0}, last_site_{0},
+        last_line_{0}, sections_entered_{0}, blocks_matched_{0}, num_jobs_{1},
+        shard_index_{0}, shard_count_{1}, num_durations_{0},
+        benchmark_samples_{30}, seed_{std::random_device{}()},
+        property_cases_{100}, perf_events_{0}, timeout_ns_{0},
+        block_timeout_ns_{0}, deadline_ns_{0}, progress_mutex_{}, progress_{},
+        progress_timeout_ns_{0},
+        progress_block_{NodeType::Block, Status::Null, "", 0},
+        shared_progress_{nullptr}, report_mutex_{}, cache_path_{}, cache_{},
+        build_id_{}, exe_path_{nullptr}, num_cached_{0},
+        cache_select_{CacheSelect::All}, failed_first_{false},
+        block_order_{BlockOrder::Declaration}, list_mode_{ListMode::None},
+        list_json_{false}, baseline_{}, baseline_path_{}, threshold_{10.0},
+        level_{0}, last_status_{Status::Null}, expand_all_{false},
+        exiting_{false}, verbose_{false}, compact_{true}, isolate_{false},
+        perf_counters_{false}, watch_progress_{false}, output_{stdout},
+        out_{&output_}, reporter_{}, report_format_{}, report_path_{},
+        report_file_{}, file_reporter_{} {}
+
+  /** Initialise the TestReferee with command line arguments. Failure will
+   *  return an ExprResult object containing an error message.
+   */
+  ExprResult init(int argc, const char *argv[]) {
+    exe_path_ = argv[0];
+    if (argc == 1)
+      return {true, ""};
+    int curr = 1;
+    do {
+      std::string arg{argv[curr]};
+      if (arg.length() == 2) {
+        if (arg[1] == 't' || arg[1] == 'x') {
+          if (curr + 1 == argc || argv[curr + 1][0] == '-') {
+            return {false, "No tags specified!"};
+          }
+          const ExprResult compiled = tag_filter_.compile(
+              argv[++curr], arg[1] == 't',
+              [this](StringRef tag) { return resolve_tags(tag); });
+          if (!compiled.status) {
+            return compiled;
+          }
+        } else if (arg[1] == 's') {
+          if (curr + 1 == argc || !select_path_.empty()) {
+            return {false, "-s requires a single block/section path!"};
+          }
+          split_path(argv[++curr], select_path_);
+        } else if (arg[1] == 'j') {
+          char *end = nullptr;
+          const long jobs =
+              curr + 1 == argc ? -1 : std::strtol(argv[curr + 1], &end, 10);
+          if (jobs < 0 || end == argv[curr + 1] || *end != '\0') {
+            return {false, "-j requires a number of jobs!"};
+          }
+          num_jobs_ = jobs > 0 ? static_cast<unsigned>(jobs)
+                               : std::thread::hardware_concurrency();
+          ++curr;
+        }
+        switch (arg[1]) {
+        case 'e':
+          expand_all_ = true;
+          verbose_ = true;
+          compact_ = false;
+          break;
+        case 'h':
+          return {false, ""};
+          break;
+        case 'i':
+#ifdef CATAPLASM_POSIX
+          isolate_ = true;
+          break;
+#else
+          return {false, "-i is not supported on this platform!"};
+#endif
+        case 'j':
+        case 's':
+        case 't':
+        case 'x':
+          break;
+        case 'v':
+          verbose_ = true;
+          compact_ = false;
+          break;
+        default:
+          return {false, arg + " is not a valid argument!"};
+          break;
+        }
+      } else if (arg.compare(0, 2, "--") == 0) {
+        ExprResult result = parse_long_option(arg, argc, argv, curr);
+        if (!result.status) {
+          return result;
+        }
+      } else {
+        return {false, arg + " is not a valid argument!"};
+      }
+      ++curr;
+    } while (curr < argc);
+    return open_report_file();
+  }
+
+  //! Create the reporter for --reporter and --out, if they were given.
+  ExprResult open_report_file() {
+    if (report_format_.empty() != report_path_.empty()) {
+      return {false, "--reporter and --out must be used together!"};
+    } else if (report_format_.empty()) {
+      return {true, ""};
+    }
+    report_file_.reset(new std::ofstream{report_path_});
+    if (!*report_file_) {
+      return {false, "Could not open " + report_path_ + " for writing!"};
+    }
+    if (report_format_ == "junit") {
+      file_reporter_.reset(new JUnitReporter{*report_file_});
+    } else {
+      file_reporter_.reset(new JsonReporter{*report_file_});
+    }
+    return {true, ""};
+  }
+
+  /** Parse an option of the form `--name [value]`, advancing `curr` past
+   *  any value it consumes.
+   */
+  ExprResult parse_long_option(const std::string &arg, int argc,
+                               const char *argv[], int &curr) {
+    const char *value = curr + 1 < argc ? argv[curr + 1] : nullptr;
+    if (arg == "--perf-counters") {
+      perf_counters_ = true;
+      return {true, ""};
+    } else if (arg == "--list-tests" || arg == "--list-tags") {
+      if (list_mode_ != ListMode::None) {
+        return {false, "Only one of --list-tests and --list-tags may be "
+                       "given!"};
+      }
+      list_mode_ = arg == "--list-tests" ? ListMode::Tests : ListMode::Tags;
+      return {true, ""};
+    } else if (arg == "--failed-first" || arg == "--last-failed" ||
+               arg == "--only-changed") {
+      if (arg == "--failed-first") {
+        failed_first_ = true;
+      } else if (cache_select_ != CacheSelect::All) {
+        return {false, "Cannot mix --last-failed and --only-changed!"};
+      } else {
+        cache_select_ = arg == "--last-failed" ? CacheSelect::LastFailed
+                                               : CacheSelect::OnlyChanged;
+      }
+      if (cache_path_.empty()) {
+        cache_path_ = ".cataplasm-cache";
+      }
+      return {true, ""};
+    }
+    if (arg == "--shard") {
+      unsigned index = 0, count = 0;
+      char extra;
+      if (!value ||
+          std::sscanf(value, "%u/%u%c", &index, &count, &extra) != 2 ||
+          index == 0 || index > count) {
+        return {false, "--shard requires INDEX/COUNT, with 1 <= INDEX <= "
+                       "COUNT!"};
+      }
+      shard_index_ = index - 1;
+      shard_count_ = count;
+    } else if (arg == "--durations") {
+      char *end = nullptr;
+      const long count = value ? std::strtol(value, &end, 10) : -1;
+      if (count < 0 || end == value || *end != '\0') {
+        return {false, "--durations requires a number of blocks!"};
+      }
+      num_durations_ = static_cast<unsigned>(count);
+    } else if (arg == "--benchmark-samples") {
+      char *end = nullptr;
+      const long count = value ? std::strtol(value, &end, 10) : -1;
+      if (count < 1 || end == value || *end != '\0') {
+        return {false, "--benchmark-samples requires a number of samples!"};
+      }
+      benchmark_samples_ = static_cast<uint32_t>(count);
+    } else if (arg == "--seed") {
+      char *end = nullptr;
+      const unsigned long long seed =
+          value ? std::strtoull(value, &end, 10) : 0;
+      if (!value || end == value || *end != '\0') {
+        return {false, "--seed requires a number!"};
+      }
+      seed_ = seed;
+    } else if (arg == "--property-cases") {
+      char *end = nullptr;
+      const long count = value ? std::strtol(value, &end, 10) : -1;
+      if (count < 1 || end == value || *end != '\0') {
+        return {false, "--property-cases requires a number of cases!"};
+      }
+      property_cases_ = static_cast<uint32_t>(count);
+    } else if (arg == "--timeout") {
+      char *end = nullptr;
+      const double limit = value ? std::strtod(value, &end) : -1.0;
+      if (limit < 0.0 || end == value || *end != '\0') {
+        return {false, "--timeout requires a number of seconds!"};
+      }
+      timeout_ns_ = static_cast<uint64_t>(limit * 1e9);
+    } else if (arg == "--order") {
+      if (value && std::strcmp(value, "decl") == 0) {
+        block_order_ = BlockOrder::Declaration;
+      } else if (value && std::strcmp(value, "rand") == 0) {
+        block_order_ = BlockOrder::Random;
+      } else if (value && std::strcmp(value, "longest-first") == 0) {
+        block_order_ = BlockOrder::LongestFirst;
+        if (cache_path_.empty()) {
+          cache_path_ = ".cataplasm-cache";
+        }
+      } else {
+        return {false, "--order requires decl, rand or longest-first!"};
+      }
+    } else if (arg == "--list-format") {
+      if (!value || (std::strcmp(value, "text") != 0 &&
+                     std::strcmp(value, "json") != 0)) {
+        return {false, "--list-format requires text or json!"};
+      }
+      list_json_ = std::strcmp(value, "json") == 0;
+    } else if (arg == "--cache") {
+      if (!value) {
+        return {false, "--cache requires a file!"};
+      }
+      cache_path_ = value;
+    } else if (arg == "--save-baseline") {
+      if (!value) {
+        return {false, "--save-baseline requires a file!"};
+      }
+      baseline_path_ = value;
+    } else if (arg == "--compare-baseline") {
+      if (!value || !read_baseline(value, baseline_)) {
+        return {false, "--compare-baseline requires a readable baseline file!"};
+      }
+    } else if (arg == "--threshold") {
+      char *end = nullptr;
+      const double percent = value ? std::strtod(value, &end) : -1.0;
+      if (percent < 0.0 || end == value || *end != '\0') {
+        return {false, "--threshold requires a percentage!"};
+      }
+      threshold_ = percent;
+    } else if (arg == "--reporter") {
+      if (!value || (std::strcmp(value, "junit") != 0 &&
+                     std::strcmp(value, "json") != 0)) {
+        return {false, "--reporter requires junit or json!"};
+      }
+      report_format_ = value;
+    } else if (arg == "--out") {
+      if (!value) {
+        return {false, "--out requires a file!"};
+      }
+      report_path_ = value;
+    } else if (arg == "--save-timings") {
+      if (!value) {
+        return {false, "--save-timings requires a file!"};
+      }
+      timings_path_ = value;
+    } else if (arg == "--shard-timings") {
+      if (!value || !read_timings(value, shard_timings_)) {
+        return {false, "--shard-timings requires a readable timings file!"};
+      }
+    } else {
+      return {false, arg + " is not a valid argument!"};
+    }
+    ++curr;
+    return {true, ""};
+  }
+
+  //! Replace the default ConsoleReporter.
+  void set_reporter(std::unique_ptr<Reporter> reporter) {
+    reporter_ = std::move(reporter);
+  }
+
+  /** Evaluate each test case, reporting each block as it finishes, then
+   *  report the totals. With --list-tests or --list-tags, list the selected
+   *  blocks or their tags instead, running nothing.
+   */
+  int run_tests() {
+    detect_colour(out_, stdout);
+    if (list_mode_ != ListMode::None) {
+      const uint32_t num_blocks = select_blocks();
+      if (list_mode_ == ListMode::Tests) {
+        list_blocks(num_blocks);
+      } else {
+        list_tags(num_blocks);
+      }
+      out_.flush();
+      return EXIT_SUCCESS;
+    }
+    if (!reporter_) {
+      reporter_.reset(new ConsoleReporter{out_, verbose_, expand_all_});
+    }
+    if (perf_counters_) {
+      perf_events_ = PerfCounters::local().events();
+      if (perf_events_ == 0) {
+        out_ << CLIAttr::Yellow
+             << "Hardware performance counters are unavailable; reporting "
+                "timings only."
+             << CLIAttr::Reset << "\n\n";
+      }
+    }
+    const uint32_t num_blocks = evaluate_blocks();
+
+    if (num_blocks == 0 && shard_count_ > 1) {
+      out_ << "No test blocks in shard " << shard_index_ + 1 << "/"
+           << shard_count_ << "." << std::endl;
+      return EXIT_SUCCESS;
+    } else if (num_blocks == 0 && num_cached_ > 0) {
+      out_ << "All " << num_cached_
+           << " selected blocks passed in this build; nothing to run."
+           << std::endl;
+      return EXIT_SUCCESS;
+    } else if (num_blocks == 0) {
+      out_ << "No test blocks found!" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    if (!benchmarks_.empty()) {
+      describe_benchmarks();
+    }
+    if (num_durations_ > 0) {
+      describe_durations(num_blocks);
+    }
+    if (perf_events_ != 0) {
+      describe_perf(num_blocks);
+    }
+    if (!timings_path_.empty()) {
+      save_timings();
+    }
+    if (!cache_path_.empty()) {
+      save_cache();
+    }
+    if (!baseline_path_.empty()) {
+      save_baseline();
+    }
+    reporter_->report_totals(totals_);
+    if (file_reporter_) {
+      file_reporter_->report_totals(totals_);
+    }
+    if (select_path_.size() > 1 && blocks_matched_ == 0) {
+      out_ << CLIAttr::Red << "No sections match -s " << select_path_string()
+           << CLIAttr::Reset << "\n";
+      out_.flush();
+      return EXIT_FAILURE;
+    }
+    out_.flush();
+    return totals_.tests_failed == 0 && totals_.benchmarks_regressed == 0
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+  }
+
+  /** Keep only the blocks selected by tags, path, shard and result cache,
+   *  in the order to run them, and return how many there are.
+   */
+  uint32_t select_blocks() {
+    if (!tag_filter_.empty() || !select_path_.empty()) {
+      block_tags_.resize(nodes_.size());
+      uint32_t kept = 0;
+      for (uint32_t block_id = 0; block_id < nodes_.size(); ++block_id) {
+        if (is_selected(block_id)) {
+          nodes_[kept++] = std::move(nodes_[block_id]);
+        }
+      }
+      nodes_.erase(nodes_.begin() + kept, nodes_.end());
+    }
+    std::vector<TagSet>().swap(block_tags_);
+    if (shard_count_ > 1) {
+      select_shard();
+    }
+    if (!cache_path_.empty()) {
+      select_cached();
+    }
+    order_blocks();
+    return nodes_.size();
+  }
+
+  /** Run the payload and update the status for each block. With -j, blocks
+   *  run in parallel, and each PROPERTY searches its cases serially within
+   *  its worker; a run of a single PROPERTY instead runs it here, searching
+   *  its cases on the -j threads.
+   */
+  uint32_t evaluate_blocks() {
+    const uint32_t num_blocks = select_blocks();
+    num_blocks_ = num_blocks;
+    totals_ = RunTotals{};
+    watch_progress_ = false;
+    for (uint32_t node_id = 0; node_id < num_blocks; ++node_id) {
+      watch_progress_ = watch_progress_ || block_timeout_ns(nodes_[node_id]);
+    }
+    if (isolate_ && num_blocks > 0) {
+      evaluate_isolated(num_blocks);
+    } else if (num_jobs_ > 1 &&
+               !(num_blocks == 1 && is_property(nodes_.front()))) {
+      evaluate_parallel(num_blocks);
+    } else {
+      Watchdog watchdog{*this, {this}};
+      for (decltype(nodes_.size()) node_id = 0; node_id < num_blocks;
+           ++node_id) {
+        block_timeout_ns_ = block_timeout_ns(nodes_[node_id]);
+        evaluate_block(node_id);
+        finish_block(node_id);
+      }
+    }
+    return num_blocks;
+  }
+
+  /** Resolve the status of a finished block, after comparing its benchmarks
+   *  with the baseline, and report it. Blocks finish in registration order,
+   *  and the nodes of each are held after the registered blocks.
+   *
+   *  Once reported, the block's counts are added to the totals, its section
+   *  runs are ranked for --durations and its subtree and run-time text are
+   *  freed, so memory is bounded by the largest block rather than the run.
+   */
+  void finish_block(uint32_t block_id) {
+    TestNode &block = nodes_[block_id];
+    for (; benchmark_names_.size() < benchmarks_.size();) {
+      const BenchmarkResult &benchmark = benchmarks_[benchmark_names_.size()];
+      benchmark_names_.push_back(names_.store(
+          block.expr.str() + " / " + nodes_[benchmark.node].expr.str()));
+      compare_baseline(benchmark, benchmark_names_.back());
+    }
+    check_selected_sections(block_id);
+    set_block_status(block);
+    {
+      // Held throughout, as a timeout may report the run from another thread.
+      std::lock_guard<std::mutex> lock{report_mutex_};
+      reporter_->report_block(nodes_, block);
+      if (file_reporter_) {
+        file_reporter_->report_block(nodes_, block);
+      }
+      ++totals_.blocks;
+      totals_.blocks_failed += block.status == Status::Fail;
+      for (auto node = nodes_.begin() + num_blocks_; node != nodes_.end();
+           ++node) {
+        totals_.tests += is_test(*node);
+        totals_.tests_failed += is_failed_test(*node);
+        totals_.benchmarks_regressed += is_failed_benchmark(*node);
+      }
+      for (const auto &site : pass_sites_) {
+        totals_.tests += site.count;
+      }
+      record_result(block);
+    }
+    if (num_durations_ > 0) {
+      collect_sections(block, block.expr.str(), slowest_sections_);
+      if (slowest_sections_.size() > 2 * num_durations_) {
+        keep_slowest(slowest_sections_, num_durations_);
+      }
+    }
+
+    nodes_.erase(nodes_.begin() + num_blocks_, nodes_.end());
+    block.release_children();
+    pass_sites_.clear();
+    site_index_.clear();
+    last_site_ = 0;
+    text_.clear();
+  }
+
+  /** Warn if a block entered no section at the depth of the path given with
+   *  -s, so that only its code outside the sections ran, and otherwise count
+   *  it as matched.
+   */
+  void check_selected_sections(uint32_t block_id) {
+    if (select_path_.size() < 2) {
+      return;
+    }
+    if (section_depth(nodes_[block_id]) + 1 >= select_path_.size()) {
+      ++blocks_matched_;
+      return;
+    }
+    nodes_[block_id].push_child(nodes_.size());
+    nodes_.emplace_back(NodeType::Warn, Status::Null,
+                        text_.store("no section matches -s " +
+                                    select_path_string()),
+                        nodes_[block_id].line);
+  }
+
+  //! Depth of the deepest section below a container, as counted by -s.
+  uint32_t section_depth(const TestNode &container) const {
+    uint32_t depth = 0;
+    for (const auto child : container) {
+      const TestNode &node = nodes_[child];
+      if (node.type == NodeType::Section) {
+        depth = std::max(depth, section_depth(node) + node.source.empty());
+      }
+    }
+    return depth;
+  }
+
+  //! The path given with -s.
+  std::string select_path_string() const {
+    std::string path;
+    for (const StringRef &name : select_path_) {
+      path += (path.empty() ? "" : "/") + name.str();
+    }
+    return path;
+  }
+
+  /** Run a block from the given path, catching any exception thrown outside
+   *  of a test. If `pinned`, only the leaves under the path are run.
+   */
+  void evaluate_block(uint32_t node_id, const std::vector<PathStep> &path = {},
+                      bool pinned = false) {
+    node_stack_.clear();
+    node_stack_.emplace_back(node_id);
+    last_line_ = nodes_[node_id].line;
+    last_status_ = Status::Null;
+    rerun_ns_ = 0;
+    saved_ns_ = 0;
+    next_section_ = path;
+    run_prefix_.clear();
+    if (pinned) {
+      run_prefix_ = path;
+    }
+    const Timing start = read_clock();
+    if (watch_progress_) {
+      update_progress();
+      std::lock_guard<std::mutex> lock{progress_mutex_};
+      progress_timeout_ns_ = block_timeout_ns_;
+      deadline_ns_ = block_timeout_ns_ ? start.wall_ns + block_timeout_ns_ : 0;
+      progress_block_ = nodes_[node_id];
+    }
+    const AllocationMark allocations = mark_allocations();
+    const PerfCounts perf =
+        perf_events_ != 0 ? PerfCounters::local().read() : PerfCounts{};
+    try {
+      run_block(nodes_[node_id].payload, node_id);
+    } catch (...) {
+      push_exception(std::current_exception(), NodeType::ThrowsOutOfNode,
+                     Status::Fail, "", last_line_);
+      next_section_.clear();
+    }
+    if (perf_events_ != 0) {
+      nodes_[node_id].perf = PerfCounters::local().read() - perf;
+    }
+    if (watch_progress_) {
+      std::lock_guard<std::mutex> lock{progress_mutex_};
+      deadline_ns_ = 0;
+    }
+    fixture_.reset();
+    nodes_[node_id].allocations = measure_allocations(allocations);
+    nodes_[node_id].time = read_clock() - start;
+    nodes_[node_id].rerun_ns = rerun_ns_;
+    nodes_[node_id].saved_ns = saved_ns_;
+  }
+
+  /** Run blocks on a pool of `num_jobs_` workers, each with its own
+   *  referee. Results are merged and reported in registration order, as
+   *  soon as every earlier block has finished, so the report matches that of
+   *  a serial run. Blocks are started in order, at most `window` past the
+   *  next block to merge, which bounds the runs waiting to be merged.
+   *
+   *  A block runs as a sequence of segments. When a segment first enters a
+   *  GENERATE, each other value is queued as a segment of its own, and the
+   *  leaves after the generator continue in a final segment, so values run
+   *  concurrently and are merged in the order a serial run would take.
+   */
+  void evaluate_parallel(uint32_t num_blocks) {
+    TaskPool pool{num_jobs_};
+    std::vector<std::unique_ptr<TestReferee>> workers;
+    for (unsigned worker = 0; worker < pool.size(); ++worker) {
+      workers.emplace_back(new TestReferee);
+      workers.back()->configure_worker(*this);
+    }
+    // Workers run copies of the blocks, as merging may reallocate nodes_.
+    const std::vector<TestNode> blocks(nodes_.begin(),
+                                       nodes_.begin() + num_blocks);
+    std::vector<uint64_t> timeouts;
+    std::vector<TestReferee *> watched;
+    for (const auto &block : blocks) {
+      timeouts.push_back(block_timeout_ns(block));
+    }
+    for (const auto &worker : workers) {
+      watched.push_back(worker.get());
+    }
+    Watchdog watchdog{*this, watched};
+    // Segments are only appended, so a deque keeps references to them valid.
+    std::vector<std::deque<BlockRun>> runs(num_blocks);
+    std::vector<uint32_t> pending(num_blocks, 0);
+    std::mutex merge_mutex;
+    uint32_t next_block = 0, next_start = 0;
+    const uint32_t window = pool.size() * 8;
+    std::function<void(unsigned, uint32_t, size_t, std::vector<PathStep>,
+                       bool)>
+        run_segment;
+    // Queue a segment of a block; merge_mutex must be held.
+    const auto queue_segment = [&](unsigned worker, uint32_t node_id,
+                                   std::vector<PathStep> path, bool pinned) {
+      runs[node_id].emplace_back();
+      ++pending[node_id];
+      const size_t segment = runs[node_id].size() - 1;
+      pool.push(
+          [&run_segment, node_id, segment, path, pinned](unsigned thread) {
+            run_segment(thread, node_id, segment, path, pinned);
+          },
+          worker);
+    };
+    // Queue blocks up to the window; merge_mutex must be held.
+    const auto start_blocks = [&](unsigned worker) {
+      for (; next_start < num_blocks && next_start < next_block + window;
+           ++next_start) {
+        queue_segment(worker++, next_start, {}, false);
+      }
+    };
+    run_segment = [&](unsigned worker, uint32_t node_id, size_t segment,
+                      std::vector<PathStep> path, bool pinned) {
+      TestReferee &referee = *workers[worker];
+      BlockRun *run;
+      {
+        std::lock_guard<std::mutex> lock{merge_mutex};
+        run = &runs[node_id][segment];
+      }
+      referee.split_values_ = [&, worker,
+                               node_id](const std::vector<PathStep> &prefix) {
+        std::lock_guard<std::mutex> lock{merge_mutex};
+        std::vector<PathStep> value_path = prefix;
+        for (uint32_t value = 1; value < prefix.back().count; ++value) {
+          value_path.back().value = value;
+          queue_segment(worker + value, node_id, value_path, true);
+        }
+      };
+      thread_referee() = &referee;
+      referee.block_timeout_ns_ = timeouts[node_id];
+      const std::vector<PathStep> rest =
+          referee.run_detached(blocks[node_id], *run, path, pinned);
+      thread_referee() = nullptr;
+      std::lock_guard<std::mutex> lock{merge_mutex};
+      if (!rest.empty()) {
+        queue_segment(worker, node_id, rest, false);
+      }
+      --pending[node_id];
+      for (; next_block < num_blocks && pending[next_block] == 0 &&
+             !runs[next_block].empty();
+           ++next_block) {
+        for (auto &block_run : runs[next_block]) {
+          // As in a serial run, an exception thrown out of the block ends it.
+          const bool aborted =
+              block_run.nodes.back().type == NodeType::ThrowsOutOfNode;
+          merge_run(next_block, block_run);
+          if (aborted) {
+            break;
+          }
+        }
+        std::deque<BlockRun>().swap(runs[next_block]);
+        finish_block(next_block);
+      }
+      start_blocks(worker);
+    };
+    {
+      std::lock_guard<std::mutex> lock{merge_mutex};
+      start_blocks(0);
+    }
+    pool.run();
+  }
+
+  /** Run blocks in batches on up to `num_jobs_` forked worker processes,
+   *  each of which streams the BlockRun of every finished block back over a
+   *  pipe. A worker which dies fails the block it was running, and the rest
+   *  of its batch is handed to a new worker.
+   */
+  void evaluate_isolated(uint32_t num_blocks) {
+#ifdef CATAPLASM_POSIX
+    const unsigned num_workers = std::max(1u, std::min(num_jobs_, num_blocks));
+    const size_t batch_size =
+        std::max(1u, std::min(16u, num_blocks / (num_workers * 8)));
+    // Batches are handed out in order, within a window of the next block to
+    // merge, to bound the finished runs waiting for an earlier block.
+    const size_t window = 2 * num_workers * batch_size;
+    std::deque<uint32_t> queue;
+    for (uint32_t node_id = 0; node_id < num_blocks; ++node_id) {
+      queue.push_back(node_id);
+    }
+    std::vector<BlockRun> runs(num_blocks);
+    std::vector<WorkerProcess> workers;
+    std::vector<pollfd> fds;
+    uint32_t next_block = 0;
+    while (!queue.empty() || !workers.empty()) {
+      for (; next_block < num_blocks && !runs[next_block].nodes.empty();
+           ++next_block) {
+        merge_run(next_block, runs[next_block]);
+        finish_block(next_block);
+      }
+      while (workers.size() < num_workers && !queue.empty() &&
+             queue.front() < next_block + window) {
+        WorkerProcess worker;
+        const size_t count = std::min(batch_size, queue.size());
+        worker.batch.assign(queue.begin(), queue.begin() + count);
+        queue.erase(queue.begin(), queue.begin() + count);
+        if (spawn_worker(worker)) {
+          workers.push_back(std::move(worker));
+        } else {
+          run_in_process(worker.batch, runs);
+        }
+      }
+      fds.clear();
+      int wait_ms = -1;
+      const uint64_t now = read_clock().wall_ns;
+      for (const auto &worker : workers) {
+        fds.push_back(pollfd{worker.fd, POLLIN, 0});
+        if (worker.deadline_ns != 0 && !worker.timed_out) {
+          const uint64_t left =
+              worker.deadline_ns > now ? worker.deadline_ns - now : 0;
+          const int ms = static_cast<int>(
+              std::min<uint64_t>(left / 1000000 + 1, 1u << 30));
+          wait_ms = wait_ms < 0 ? ms : std::min(wait_ms, ms);
+        }
+      }
+      if (fds.empty()) {
+        continue;
+      }
+      if (poll(fds.data(), fds.size(), wait_ms) < 0 && errno != EINTR) {
+        break;
+      }
+      for (size_t i = workers.size(); i-- > 0;) {
+        if (fds[i].revents != 0 && !read_worker(workers[i], runs)) {
+          reap_worker(workers[i], runs, queue);
+          workers.erase(workers.begin() + i);
+        } else {
+          watch_worker(workers[i]);
+        }
+      }
     }
-    const auto num_blocks = nodes_.size();
-    for (decltype(nodes_.size()) node_id = 0; node_id < num_blocks; ++node_id) {
-      TestNode &block = nodes_[node_id];
-      node_stack_.clear();
-      node_stack_.emplace_back(node_id);
-      try {
-        run_block(block.payload, node_id);
-      } catch (...) {
-        push_exception(std::current_exception(), NodeType::ThrowsOutOfNode,
-                       Status::Fail, "", nodes_.back().line);
+    for (; next_block < num_blocks; ++next_block) {
+      merge_run(next_block, runs[next_block]);
+      finish_block(next_block);
+    }
+#else
+    (void)num_blocks;
+#endif
+  }
+
+  //! Copy the settings which affect how tests are recorded.
+  void configure_worker(const TestReferee &parent) {
+    expand_all_ = parent.expand_all_;
+    verbose_ = parent.verbose_;
+    compact_ = parent.compact_;
+    select_path_ = parent.select_path_;
+    benchmark_samples_ = parent.benchmark_samples_;
+    // The parent's threads are all running workers, so search serially.
+    num_jobs_ = 1;
+    seed_ = parent.seed_;
+    property_cases_ = parent.property_cases_;
+    perf_counters_ = parent.perf_counters_;
+    perf_events_ = parent.perf_events_;
+    watch_progress_ = parent.watch_progress_;
+  }
+
+  /** Run a copy of the given block as the only block in this referee, and
+   *  move the resulting nodes into `run`. The block is node 0 of the run.
+   *  The run starts from `path` and, if `pinned`, covers only the leaves
+   *  under it. Returns the path to continue from if a generator was split,
+   *  or an empty path.
+   */
+  std::vector<PathStep> run_detached(const TestNode &block, BlockRun &run,
+                                     const std::vector<PathStep> &path = {},
+                                     bool pinned = false) {
+    nodes_.clear();
+    pass_sites_.clear();
+    site_index_.clear();
+    benchmarks_.clear();
+    last_site_ = 0;
+    nodes_.push_back(block);
+    evaluate_block(0, path, pinned);
+    run.nodes.swap(nodes_);
+    run.pass_sites.swap(pass_sites_);
+    run.benchmarks.swap(benchmarks_);
+    run.text.merge(text_);
+    if (pinned || run_prefix_.empty()) {
+      return {};
+    }
+    return next_section_;
+  }
+
+#ifdef CATAPLASM_POSIX
+  //! A forked process running a batch of blocks.
+  struct WorkerProcess {
+    pid_t pid;
+    int fd;                      //<! Read end of the result pipe.
+    std::vector<uint32_t> batch; //<! Blocks to run, in order.
+    size_t done;                 //<! Number of results received.
+    std::string buffer;          //<! Data read but not yet decoded.
+    size_t armed;         //<! Index of the block the deadline is for.
+    uint64_t deadline_ns; //<! When the running block times out, or 0.
+    bool timed_out;       //<! If the worker was killed for timing out.
+    char *progress; //<! Shared page holding the worker's progress, if any.
+  };
+
+  //! Fork a worker process for the batch; false if that is not possible.
+  bool spawn_worker(WorkerProcess &worker) {
+    out_.flush();
+    std::cout.flush();
+    std::fflush(nullptr);
+    int fds[2];
+    if (pipe(fds) != 0) {
+      return false;
+    }
+    worker.progress = nullptr;
+    if (watch_progress_) {
+      void *page = mmap(nullptr, PROGRESS_BYTES, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (page != MAP_FAILED) {
+        worker.progress = static_cast<char *>(page);
+        worker.progress[0] = '\0';
       }
     }
-    for (decltype(nodes_.size()) node_id = 0; node_id < num_blocks; ++node_id) {
-      set_block_status(nodes_[node_id]);
+    const pid_t pid = fork();
+    if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      if (worker.progress) {
+        munmap(worker.progress, PROGRESS_BYTES);
+      }
+      return false;
     }
-    return num_blocks;
+    if (pid == 0) {
+      close(fds[0]);
+      run_worker_process(worker.batch, fds[1], worker.progress);
+    }
+    close(fds[1]);
+    worker.pid = pid;
+    worker.fd = fds[0];
+    worker.done = 0;
+    worker.timed_out = false;
+    arm_worker(worker);
+    return true;
+  }
+
+  //! Start the time limit of the block a worker is now running, if any.
+  void arm_worker(WorkerProcess &worker) const {
+    worker.armed = worker.done;
+    const uint64_t timeout =
+        worker.done < worker.batch.size()
+            ? block_timeout_ns(nodes_[worker.batch[worker.done]])
+            : 0;
+    worker.deadline_ns = timeout ? read_clock().wall_ns + timeout : 0;
+  }
+
+  /** Restart the time limit when a worker moves on to its next block, and
+   *  kill a worker whose block has passed its deadline.
+   */
+  void watch_worker(WorkerProcess &worker) const {
+    if (worker.done != worker.armed) {
+      arm_worker(worker);
+    } else if (worker.deadline_ns != 0 && !worker.timed_out &&
+               read_clock().wall_ns >= worker.deadline_ns) {
+      kill(worker.pid, SIGKILL);
+      worker.timed_out = true;
+    }
+  }
+
+  /** Entry point of a worker process: run each block of the batch and
+   *  write a message of [size][block][BlockRun] for it to `fd`. The path of
+   *  the running sections is kept in `progress`, if given.
+   */
+  void run_worker_process(const std::vector<uint32_t> &batch, int fd,
+                          char *progress) {
+    TestReferee referee;
+    referee.configure_worker(*this);
+    referee.shared_progress_ = progress;
+    thread_referee() = &referee;
+    std::string message;
+    for (auto node_id : batch) {
+      BlockRun run;
+      referee.run_detached(nodes_[node_id], run);
+      message.assign(2 * sizeof(uint32_t), '\0');
+      run.serialize(message);
+      const uint32_t header[2] = {
+          static_cast<uint32_t>(message.size() - sizeof(header)), node_id};
+      std::memcpy(&message[0], header, sizeof(header));
+      for (size_t written = 0; written < message.size();) {
+        const ssize_t result =
+            write(fd, message.data() + written, message.size() - written);
+        if (result < 0 && errno != EINTR) {
+          _exit(EXIT_FAILURE);
+        }
+        written += result > 0 ? result : 0;
+      }
+    }
+    std::cout.flush();
+    std::fflush(nullptr);
+    _exit(EXIT_SUCCESS);
+  }
+
+  //! Read and decode results from a worker; false once the pipe is closed.
+  bool read_worker(WorkerProcess &worker, std::vector<BlockRun> &runs) {
+    char data[65536];
+    const ssize_t size = read(worker.fd, data, sizeof(data));
+    if (size < 0) {
+      return errno == EINTR || errno == EAGAIN;
+    } else if (size == 0) {
+      return false;
+    }
+    worker.buffer.append(data, size);
+    size_t pos = 0;
+    uint32_t header[2];
+    while (worker.buffer.size() - pos >= sizeof(header)) {
+      std::memcpy(header, worker.buffer.data() + pos, sizeof(header));
+      if (worker.buffer.size() - pos - sizeof(header) < header[0]) {
+        break;
+      }
+      const uint32_t node_id = header[1];
+      if (worker.done < worker.batch.size() &&
+          worker.batch[worker.done] == node_id) {
+        if (runs[node_id].deserialize(nodes_[node_id],
+                                      worker.buffer.data() + pos +
+                                          sizeof(header),
+                                      header[0])) {
+          ++worker.done;
+        } else {
+          runs[node_id] = BlockRun{};
+        }
+      }
+      pos += sizeof(header) + header[0];
+    }
+    worker.buffer.erase(0, pos);
+    return true;
+  }
+
+  /** Wait for a worker whose pipe has closed. If it did not finish its
+   *  batch, fail the block it was running, as timed out if it was killed
+   *  for that, and queue the rest of the batch.
+   */
+  void reap_worker(WorkerProcess &worker, std::vector<BlockRun> &runs,
+                   std::deque<uint32_t> &queue) {
+    close(worker.fd);
+    int status = 0;
+    while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    std::string progress;
+    if (worker.progress) {
+      progress = worker.progress;
+      munmap(worker.progress, PROGRESS_BYTES);
+    }
+    if (worker.done >= worker.batch.size()) {
+      return;
+    }
+    const uint32_t node_id = worker.batch[worker.done];
+    NodeType type = NodeType::Crash;
+    std::string reason;
+    if (worker.timed_out) {
+      type = NodeType::Timeout;
+      reason = format_timeout(block_timeout_ns(nodes_[node_id]),
+                              progress.empty() ? nodes_[node_id].expr.str()
+                                               : progress);
+    } else if (WIFSIGNALED(status)) {
+      reason = std::string(signal_name(WTERMSIG(status))) + " (signal " +
+               std::to_string(WTERMSIG(status)) + ")";
+    } else {
+      reason = "exit code " + std::to_string(WEXITSTATUS(status));
+    }
+    BlockRun &run = runs[node_id];
+    run = BlockRun{};
+    run.nodes.push_back(nodes_[node_id]);
+    run.nodes.front().push_child(1);
+    run.nodes.emplace_back(type, Status::Fail, run.text.store(reason),
+                           nodes_[node_id].line);
+    queue.insert(queue.begin(), worker.batch.begin() + worker.done + 1,
+                 worker.batch.end());
+  }
+
+  //! Run a batch on this process, if a worker process could not be forked.
+  void run_in_process(const std::vector<uint32_t> &batch,
+                      std::vector<BlockRun> &runs) {
+    TestReferee referee;
+    referee.configure_worker(*this);
+    thread_referee() = &referee;
+    for (auto node_id : batch) {
+      referee.run_detached(nodes_[node_id], runs[node_id]);
+    }
+    thread_referee() = nullptr;
+  }
+
+  //! Return the name of a signal which may terminate a worker.
+  static const char *signal_name(int signal) {
+    switch (signal) {
+    case SIGABRT:
+      return "SIGABRT";
+    case SIGBUS:
+      return "SIGBUS";
+    case SIGFPE:
+      return "SIGFPE";
+    case SIGILL:
+      return "SIGILL";
+    case SIGKILL:
+      return "SIGKILL";
+    case SIGPIPE:
+      return "SIGPIPE";
+    case SIGSEGV:
+      return "SIGSEGV";
+    case SIGTERM:
+      return "SIGTERM";
+    case SIGTRAP:
+      return "SIGTRAP";
+    default:
+      return "Signal";
+    }
+  }
+#endif
+
+  /** Append the nodes of a detached run to the given block. The times of
+   *  several runs of one block, from split generators, are summed.
+   */
+  void merge_run(uint32_t block_id, BlockRun &run) {
+    if (run.nodes.empty()) {
+      return;
+    }
+    const uint32_t offset = nodes_.size() - 1;
+    TestNode &block = nodes_[block_id];
+    block.time.wall_ns += run.nodes.front().time.wall_ns;
+    block.time.cpu_ns += run.nodes.front().time.cpu_ns;
+    block.rerun_ns += run.nodes.front().rerun_ns;
+    block.saved_ns += run.nodes.front().saved_ns;
+    const AllocationStats &allocations = run.nodes.front().allocations;
+    block.allocations.count += allocations.count;
+    block.allocations.bytes += allocations.bytes;
+    block.allocations.peak_bytes =
+        std::max(block.allocations.peak_bytes, allocations.peak_bytes);
+    block.perf += run.nodes.front().perf;
+    for (auto child : run.nodes.front()) {
+      block.push_child(child + offset);
+    }
+    for (auto node = run.nodes.begin() + 1; node != run.nodes.end(); ++node) {
+      node->offset_children(offset);
+      nodes_.emplace_back(std::move(*node));
+    }
+    for (auto site : run.pass_sites) {
+      site.container = site.container == 0 ? block_id : site.container + offset;
+      pass_sites_.push_back(site);
+    }
+    for (auto benchmark : run.benchmarks) {
+      benchmark.block = block_id;
+      benchmark.node += offset;
+      benchmarks_.push_back(benchmark);
+    }
+    text_.merge(run.text);
+    run = BlockRun{};
   }
 
-  void push_node(NodeType type, Status status, std::string expr, uint32_t line,
-                 std::string tags = "", payload_fn fn = nullptr,
+  /** Push a node into the current container. For containers, `source` holds
+   *  the tags, which are split here; all text must outlive the referee.
+   */
+  void push_node(NodeType type, Status status, StringRef expr, uint32_t line,
+                 StringRef source = {}, payload_fn fn = nullptr,
                  bool no_push = false) {
+    AllocationPause pause;
+    last_line_ = line;
+    last_status_ = status;
+    if (compact_ && status == Status::Succeed && is_test_type(type)) {
+      count_pass(type, line);
+      return;
+    }
     const uint32_t node_id = nodes_.size();
     if (!node_stack_.empty()) {
       nodes_[node_stack_.back()].push_child(node_id);
     }
-    nodes_.emplace_back(type, status, expr, line, tags, fn);
-    if (is_container(type) && !no_push) {
+    if (!is_container(type)) {
+      nodes_.emplace_back(type, status, expr, line, source, fn);
+      return;
+    }
+    if (expr.empty() || expr == "Anonymous Node") {
+      TextPool &pool = type == NodeType::Section ? text_ : names_;
+      expr = pool.store((type == NodeType::Section ? "Anonymous section"
+                                                   : "Anonymous block") +
+                        std::string(" (line ") + std::to_string(line) + ")");
+    }
+    nodes_.emplace_back(type, status, expr, line, StringRef{}, fn);
+    nodes_.back().tags_begin = tags_.size();
+    split_string(source, tags_);
+    nodes_.back().tags_end = tags_.size();
+    if (!no_push) {
+      node_stack_.emplace_back(node_id);
+    }
+  }
+
+  //! Register a block, with the file it is defined in.
+  void push_block(NodeType type, Status status, const NameTags &data,
+                  uint32_t line, payload_fn fn, const char *file) {
+    push_node(type, status, data.name, line, data.tags, fn, true);
+    nodes_.back().source = file;
+    block_tags_.resize(nodes_.size());
+    for (uint32_t tag = nodes_.back().tags_begin; tag < tags_.size(); ++tag) {
+      block_tags_.back().insert(intern_tag(tags_[tag]));
+    }
+  }
+
+  //! Push the node for a finished benchmark, and record its statistics.
+  void push_benchmark(StringRef name, uint32_t line,
+                      const BenchmarkStats &stats) {
+    std::ostringstream os;
+    os << "mean " << format_ns(stats.mean) << ", median "
+       << format_ns(stats.median) << ", stddev " << format_ns(stats.stddev)
+       << ", min " << format_ns(stats.min) << " (" << stats.samples
+       << " samples of " << stats.iterations << " iterations, "
+       << stats.outliers << " outliers)";
+    if (perf_events_ != 0) {
+      os << "\n"
+         << format_perf(stats.perf, perf_events_,
+                        static_cast<double>(stats.samples) * stats.iterations)
+         << " per iteration";
+    }
+    push_node(NodeType::Benchmark, Status::Succeed, name, line,
+              text_.store(os.str()));
+    benchmarks_.push_back(BenchmarkResult{
+        node_stack_.empty() ? 0 : node_stack_.front(),
+        static_cast<uint32_t>(nodes_.size() - 1), stats});
+  }
+
+  //! Mask of the hardware events counted, or 0 without --perf-counters.
+  uint32_t perf_events() const { return perf_events_; }
+
+  //! Number of timed samples to take for each benchmark.
+  uint32_t benchmark_samples() const { return benchmark_samples_; }
+
+  //! Push a NOTICE or WARN node, copying its message.
+  void push_message(NodeType type, const std::string &message, uint32_t line) {
+    push_node(type, Status::Null, text_.store(message), line);
+  }
+
+  /** Push the node for an assertion, expanding the expression only if the
+   *  assertion failed or all expressions are to be expanded. Returns the
+   *  status of the new node.
+   */
+  Status push_result(NodeType type, Status pass, Status fail,
+                     const ExprResult &result, uint32_t line,
+                     const char *expr_str) {
+    AllocationPause pause;
+    const Status status = result.status ? pass : fail;
+    push_node(type, status,
+              (status == Status::Fail || expand_all_)
+                  ? text_.store(result.expand())
+                  : StringRef{},
+              line, expr_str);
+    return status;
+  }
+
+  /** Push the node for an allocation test: ENSURE_NO_ALLOC passes if
+   *  nothing was allocated, ENSURE_PEAK_BYTES_LE if the peak bytes live
+   *  were within `limit`. Without allocation tracking, a warning is pushed
+   *  instead. Returns the status of the new node.
+   */
+  Status push_allocations(NodeType type, const AllocationStats &stats,
+                          uint64_t limit, uint32_t line, const char *expr_str) {
+    AllocationPause pause;
+    if (!allocations_tracked()) {
+      push_node(NodeType::Warn, Status::Null,
+                "allocations are not tracked; define "
+                "CATAPLASM_TRACK_ALLOCATIONS with CATAPLASM_MAIN",
+                line);
+      return Status::Null;
+    }
+    const bool passed = type == NodeType::EnsureNoAlloc
+                            ? stats.count == 0
+                            : stats.peak_bytes <= limit;
+    const Status status = passed ? Status::Succeed : Status::Fail;
+    StringRef expansion;
+    if (status == Status::Fail || expand_all_) {
+      std::ostringstream os;
+      if (type == NodeType::EnsurePeakBytes) {
+        os << "peak " << stats.peak_bytes << " <= " << limit << " bytes, ";
+      }
+      os << format_allocations(stats);
+      expansion = text_.store(os.str());
+    }
+    push_node(type, status, expansion, line, expr_str);
+    return status;
+  }
+
+  void push_exception(std::exception_ptr excep, NodeType type, Status status,
+                      StringRef expr_str, uint32_t line) {
+    AllocationPause pause;
+    if (compact_ && status == Status::Succeed && is_test_type(type)) {
+      last_line_ = line;
+      last_status_ = status;
+      count_pass(type, line);
+      return;
+    }
+    push_node(type, status, text_.store(rethrow_get_info(excep)), line,
+              expr_str);
+  }
+
+  /** Run a block once per leaf section or generated value, starting from
+   *  the path in `next_section_` (empty for the first leaf), until every leaf
+   *  under `run_prefix_` has run. The wall time of each re-run, less the
+   *  time spent in the leaf it reached, is added to `rerun_ns_`.
+   */
+  void run_block(void (*block)(), uint32_t node_id) {
+    section_timers_.clear();
+    do {
+      const bool rerun = !next_section_.empty();
+      node_stack_.clear();
       node_stack_.emplace_back(node_id);
+      section_stack_.clear();
+      const uint32_t section_end = nodes_.size() - 1;
+      exiting_ = false;
+      level_ = 0;
+      leaf_ns_ = 0;
+      const Timing start = read_clock();
+      block();
+      while (!section_stack_.empty()) {
+        pop_step();
+      }
+      if (rerun) {
+        rerun_ns_ += (read_clock() - start).wall_ns - leaf_ns_;
+        if (section_end + 1 < nodes_.size()) {
+          nodes_[section_end + 1].new_run = true;
+        }
+      }
+    } while (!next_section_.empty() && has_prefix(next_section_, run_prefix_));
+  }
+
+  //! Rethrow an exception_ptr and display the details for that exception.
+  std::string rethrow_get_info(std::exception_ptr excep) const {
+    try {
+      if (excep) {
+        std::rethrow_exception(excep);
+      }
+    } catch (const std::exception &e) {
+      return e.what();
+    } catch (...) {
+      return "unknown exception";
+    }
+    return "no exception";
+  }
+
+  /**  Push a section into the section stack, and increase the level. If
+   *   we're entering this section to navigate to a leaf node section,
+   *   push a TestNode for the section. If we're exiting from a leaf
+   *   node, store this as the next leaf node to be executed. Sections
+   *   off the path given with -s are never entered nor stored.
+   */
+  bool push_section(uint32_t line_number, StringRef name) {
+    AllocationPause pause;
+    PathStep step{line_number, 0, 0, false};
+    if (!is_selected_section(name)) {
+      section_stack_.push_back(step);
+      ++level_;
+      return false;
+    }
+    if (push_step(step)) {
+      enter_step(name, line_number);
+    }
+    return step.entered;
+  }
+
+  /**  Pop a section from the section stack, after leaving any values
+   *   generated within it.
+   */
+  void pop_section() {
+    AllocationPause pause;
+    while (section_stack_.back().count > 0) {
+      pop_step();
+    }
+    pop_step();
+  }
+
+  /** Push the step of the GENERATE on `line`, which has `count` values, and
+   *  return it; its `value` is the index of the value for this run. Each
+   *  value is entered like a section, which lasts until the end of the
+   *  enclosing section or block, and is reported as a section named for the
+   *  value.
+   */
+  PathStep push_generator(uint32_t line, const char *expr, size_t count) {
+    AllocationPause pause;
+    if (count == 0) {
+      throw std::invalid_argument(std::string(expr) + " has no values");
+    }
+    PathStep step{line, 0, static_cast<uint32_t>(count), false};
+    push_step(step);
+    return step;
+  }
+
+  //! Enter the innermost step, pushed by push_generator(), for its value.
+  void enter_generated(const char *expr, const std::string &value) {
+    AllocationPause pause;
+    const PathStep step = section_stack_.back();
+    std::ostringstream name;
+    name << expr << " [" << step.value + 1 << "/" << step.count
+         << "]: " << value;
+    enter_step(text_.store(name.str()), step.line, expr);
+    split_values(step);
+  }
+
+  /** Return the running block's fixture, building it with `build` on the
+   *  block's first run. Each later run, to reach another leaf, copies it
+   *  instead of building it again, saving the time it took to build.
+   */
+  const void *block_fixture(void *(*build)(), void (*destroy)(void *)) {
+    if (!fixture_) {
+      const Timing start = read_clock();
+      fixture_ = std::shared_ptr<void>(build(), destroy);
+      fixture_ns_ = (read_clock() - start).wall_ns;
+    } else {
+      saved_ns_ += fixture_ns_;
+    }
+    return fixture_.get();
+  }
+
+  /** Push a section or generator onto the section stack, and increase the
+   *  level. The step is entered when descending to a new leaf, or when it is
+   *  on the path to the next leaf, whose generated value it takes. When
+   *  exiting a leaf, the first step reached is instead stored as the path
+   *  to the next leaf. Returns true if the step was entered.
+   */
+  bool push_step(PathStep &step) {
+    const size_t level = static_cast<size_t>(level_);
+    if (!exiting_ && level < next_section_.size()) {
+      if (next_section_[level].line == step.line) {
+        step.value = next_section_[level].value;
+        step.entered = true;
+      }
+    } else if (!exiting_) {
+      step.entered = true;
+    } else if (next_section_.empty()) {
+      next_section_ = section_stack_;
+      next_section_.push_back(step);
+    }
+    section_stack_.push_back(step);
+    ++level_;
+    return step.entered;
+  }
+
+  //! Push a TestNode for an entered step, and start timing it.
+  void enter_step(StringRef name, uint32_t line_number,
+                  StringRef source = {}) {
+    push_node(NodeType::Section, Status::Null, name, line_number);
+    nodes_.back().source = source;
+    section_timers_.push_back(
+        SectionTimer{static_cast<uint32_t>(nodes_.size() - 1),
+                     ++sections_entered_, read_clock(), mark_allocations()});
+    update_progress();
+  }
+
+  /** Pop the innermost step from the section stack, and decrease the level.
+   *  If we're exiting from a leaf node, clear the next_section_ record and
+   *  set the exiting_ flag. A generator left while exiting, with no next
+   *  leaf stored, stores its next value as the next leaf, unless its value
+   *  is pinned by `run_prefix_`.
+   */
+  void pop_step() {
+    AllocationPause pause;
+    const PathStep step = section_stack_.back();
+    const size_t index = section_stack_.size() - 1;
+    if (step.entered && !section_timers_.empty()) {
+      const SectionTimer &timer = section_timers_.back();
+      TestNode &section = nodes_[timer.node];
+      section.time = read_clock() - timer.start;
+      section.allocations = measure_allocations(timer.allocations);
+      if (timer.entered == sections_entered_) {
+        leaf_ns_ += section.time.wall_ns;
+      }
+      section_timers_.pop_back();
+      update_progress();
+    }
+    if (step.entered && !exiting_) {
+      next_section_.clear();
+      exiting_ = true;
+    }
+    const bool pinned =
+        index < run_prefix_.size() && run_prefix_[index] == step;
+    if (exiting_ && next_section_.empty() && step.value + 1 < step.count &&
+        !pinned) {
+      next_section_ = section_stack_;
+      ++next_section_.back().value;
+    }
+    section_stack_.pop_back();
+    --level_;
+  }
+
+  /** Record the path of the running block and its entered sections, for
+   *  reporting a timeout, if any block has a time limit.
+   */
+  void update_progress() {
+    if (!watch_progress_) {
+      return;
+    }
+    std::string path = nodes_[node_stack_.front()].expr.str();
+    for (const auto &timer : section_timers_) {
+      path += " / " + nodes_[timer.node].expr.str();
+    }
+    if (shared_progress_) {
+      const size_t size = std::min(path.size(), PROGRESS_BYTES - 1);
+      std::memcpy(shared_progress_, path.data(), size);
+      shared_progress_[size] = '\0';
+    }
+    std::lock_guard<std::mutex> lock{progress_mutex_};
+    progress_.swap(path);
+  }
+
+  /** Return the time limit of a block, in nanoseconds: SECONDS from a
+   *  "timeout=SECONDS" tag, or else the --timeout. 0 means no limit.
+   */
+  uint64_t block_timeout_ns(const TestNode &block) const {
+    for (uint32_t tag = block.tags_begin; tag < block.tags_end; ++tag) {
+      const StringRef name = tags_[tag];
+      if (name.size > 8 && std::strncmp(name.data, "timeout=", 8) == 0) {
+        const double limit =
+            std::strtod(std::string(name.begin() + 8, name.end()).c_str(),
+                        nullptr);
+        return limit > 0.0 ? static_cast<uint64_t>(limit * 1e9) : 0;
+      }
+    }
+    return timeout_ns_;
+  }
+
+  /** Watches the deadlines of the referees running blocks in this process,
+   *  from a thread of its own, while any block has a time limit. The thread
+   *  running a block cannot be stopped, so a block which times out is
+   *  reported and ends the run.
+   */
+  class Watchdog {
+  public:
+    Watchdog(TestReferee &parent, std::vector<TestReferee *> referees)
+        : parent_(parent), referees_{std::move(referees)}, mutex_{},
+          stopped_{}, stop_{false}, thread_{} {
+      if (parent_.watch_progress_) {
+        thread_ = std::thread{&Watchdog::watch, this};
+      }
+    }
+    ~Watchdog() {
+      if (thread_.joinable()) {
+        {
+          std::lock_guard<std::mutex> lock{mutex_};
+          stop_ = true;
+        }
+        stopped_.notify_all();
+        thread_.join();
+      }
+    }
+    Watchdog(const Watchdog &) = delete;
+    Watchdog &operator=(const Watchdog &) = delete;
+
+  private:
+    enum : unsigned { POLL_MS = 20 };
+
+    void watch() {
+      std::unique_lock<std::mutex> lock{mutex_};
+      while (!stopped_.wait_for(lock, std::chrono::milliseconds(POLL_MS),
+                                [this] { return stop_; })) {
+        const uint64_t now = read_clock().wall_ns;
+        for (auto *referee : referees_) {
+          const uint64_t deadline = referee->deadline_ns_;
+          if (deadline != 0 && now >= deadline) {
+            parent_.abort_timed_out(*referee, deadline);
+          }
+        }
+      }
+    }
+
+    TestReferee &parent_;
+    std::vector<TestReferee *> referees_;
+    std::mutex mutex_;
+    std::condition_variable stopped_;
+    bool stop_;
+    std::thread thread_;
+  };
+
+  /** Report the block run by `referee` as timed out, if it is still running
+   *  past the given deadline, then report the totals, save the result cache
+   *  and timings, and end the run with a failure.
+   */
+  void abort_timed_out(TestReferee &referee, uint64_t deadline) {
+    BlockRun run;
+    {
+      std::lock_guard<std::mutex> lock{referee.progress_mutex_};
+      if (referee.deadline_ns_ != deadline) {
+        return;
+      }
+      run.nodes.push_back(referee.progress_block_);
+      run.nodes.front().time = Timing{referee.progress_timeout_ns_, 0};
+      run.nodes.emplace_back(
+          NodeType::Timeout, Status::Fail,
+          run.text.store(format_timeout(referee.progress_timeout_ns_,
+                                        referee.progress_)),
+          run.nodes.front().line);
+    }
+    TestNode &block = run.nodes.front();
+    block.status = Status::Fail;
+    block.release_children();
+    block.push_child(1);
+    // The thread running the block may still be using the referees' nodes,
+    // so only the copied block and what finish_block() kept are used.
+    std::lock_guard<std::mutex> lock{report_mutex_};
+    reporter_->report_block(run.nodes, block);
+    if (file_reporter_) {
+      file_reporter_->report_block(run.nodes, block);
+    }
+    ++totals_.blocks;
+    ++totals_.blocks_failed;
+    ++totals_.tests;
+    ++totals_.tests_failed;
+    record_result(block);
+    out_ << "Stopping the run, as a block cannot be stopped within the "
+            "process; use -i to fail only the blocks which time out.\n\n";
+    if (!timings_path_.empty()) {
+      save_timings();
+    }
+    if (!cache_path_.empty()) {
+      save_cache();
+    }
+    reporter_->report_totals(totals_);
+    if (file_reporter_) {
+      file_reporter_->report_totals(totals_);
+    }
+    out_.flush();
+    if (report_file_) {
+      report_file_->flush();
+    }
+    std::_Exit(EXIT_FAILURE);
+  }
+
+  /** Hand the other values of a generator entered at its first value to
+   *  `split_values_`, if set, to be run concurrently, then pin this run to
+   *  the first value. Only the first generator reached outside a pinned
+   *  prefix is split.
+   */
+  void split_values(const PathStep &step) {
+    if (!split_values_ || !run_prefix_.empty() || step.value != 0 ||
+        step.count < 2) {
+      return;
+    }
+    run_prefix_ = section_stack_;
+    split_values_(run_prefix_);
+  }
+
+  /** Check a PROPERTY. Cases are generated from the seed and run in probe
+   *  referees on up to `num_jobs_` threads; the first failing case is then
+   *  shrunk by repeatedly taking the first simpler candidate which still
+   *  fails. The same threads search the cases and every round of shrinking.
+   *  The counterexample is run once more in this referee, under a section
+   *  describing it, and added to the expansion of each failure.
+   */
+  void check_property(PropertyCases &cases, const char *params) {
+    const TestNode &block = nodes_[node_stack_.front()];
+    const uint32_t line = block.line;
+    const uint64_t seed = mix_seed(seed_ ^ hash_string(block.expr));
+    size_t failed = property_cases_;
+    size_t num_candidates = 0;
+    bool shrinking = false;
+    uint32_t shrinks = 0;
+    search_failures(
+        property_cases_,
+        [&](TestReferee &probe, size_t index) {
+          return probe.probe([&] {
+            if (shrinking) {
+              cases.run_candidate(index);
+            } else {
+              cases.run_case(mix_seed(seed + index));
+            }
+          });
+        },
+        [&](size_t found) -> size_t {
+          if (!shrinking) {
+            if (found == property_cases_) {
+              return 0;
+            }
+            failed = found;
+            num_candidates = cases.take_case(mix_seed(seed + found));
+            shrinking = true;
+          } else if (found == num_candidates) {
+            return 0;
+          } else {
+            num_candidates = cases.take_candidate(found);
+            if (++shrinks == MAX_SHRINKS) {
+              return 0;
+            }
+          }
+          return num_candidates;
+        });
+    if (failed == property_cases_) {
+      push_node(NodeType::Pass, Status::Succeed,
+                text_.store(std::to_string(property_cases_) + " cases passed"),
+                line);
+      return;
+    }
+
+    std::ostringstream name;
+    name << "Counterexample from case " << failed + 1 << " of "
+         << property_cases_ << ", shrunk " << shrinks
+         << (shrinks == 1 ? " time" : " times") << " (--seed " << seed_
+         << ")";
+    push_node(NodeType::Section, Status::Null, text_.store(name.str()), line);
+    nodes_.back().source = "PROPERTY";
+    const std::string with = std::string(" with ") + params + " = " +
+                             cases.describe_counterexample();
+    const size_t first_node = nodes_.size();
+    run_leaves([&] { cases.run_counterexample(); }, line, false);
+    bool reproduced = false;
+    for (size_t node_id = first_node; node_id < nodes_.size(); ++node_id) {
+      TestNode &node = nodes_[node_id];
+      if (is_failed_test(node)) {
+        node.expr = text_.store(node.expr.str() + with);
+        reproduced = true;
+      }
+    }
+    if (!reproduced) {
+      push_node(NodeType::Fail, Status::Fail,
+                text_.store("counterexample" + with + " passed when re-run"),
+                line);
+    }
+  }
+
+  //! Status of the most recent node, including passing tests not stored.
+  Status last_status() const { return last_status_; }
+
+  //! Line of the most recent node, including passing tests not stored.
+  uint32_t last_line() const { return last_line_; }
+
+  TestNode &lastNode() {
+    static TestNode null{NodeType::Warn, Status::Null,
+                         "lastNode() called on empty TestReferee", __LINE__};
+    if (nodes_.empty()) {
+      return null;
+    }
+    return nodes_.back();
+  }
+
+private:
+  //! Shrinking steps to take at most for one PROPERTY.
+  static const uint32_t MAX_SHRINKS = 1000;
+
+  //! Scramble a seed with the splitmix64 finaliser.
+  static uint64_t mix_seed(uint64_t seed) { return CaseRng{seed}(); }
+
+  /** Run a function in this referee as though it were the body of a block,
+   *  once per leaf section, returning true if a test failed or an exception
+   *  escaped. Stops at the first leaf which fails.
+   */
+  bool probe(const std::function<void()> &fn) {
+    nodes_.assign(1, TestNode{NodeType::Block, Status::Null, "", 0});
+    pass_sites_.clear();
+    site_index_.clear();
+    last_site_ = 0;
+    text_.clear();
+    next_section_.clear();
+    node_stack_.assign(1, 0);
+    section_timers_.clear();
+    TestReferee *const caller = thread_referee();
+    thread_referee() = this;
+    run_leaves(fn, 0, true);
+    thread_referee() = caller;
+    return std::any_of(nodes_.begin(), nodes_.end(), is_failed_test);
+  }
+
+  /** Run `fn` once per leaf section, with the nodes of each leaf below the
+   *  innermost node, as run_block() does for a block. An exception escaping
+   *  `fn` fails the leaf at `line`. Stops at the first leaf which fails if
+   *  `stop_on_fail`. Generators within `fn` are never split.
+   */
+  template <typename Fn>
+  void run_leaves(const Fn &fn, uint32_t line, bool stop_on_fail) {
+    const std::vector<uint32_t> node_stack = node_stack_;
+    std::function<void(const std::vector<PathStep> &)> split;
+    split.swap(split_values_);
+    next_section_.clear();
+    do {
+      node_stack_ = node_stack;
+      section_stack_.clear();
+      exiting_ = false;
+      level_ = 0;
+      try {
+        fn();
+      } catch (...) {
+        push_exception(std::current_exception(), NodeType::ThrowsUnexpected,
+                       Status::Fail, "", line);
+      }
+      while (!section_stack_.empty()) {
+        pop_step();
+      }
+    } while (!next_section_.empty() &&
+             !(stop_on_fail && std::any_of(nodes_.begin(), nodes_.end(),
+                                           is_failed_test)));
+    next_section_.clear();
+    split.swap(split_values_);
+  }
+
+  /** Search for failing cases in rounds, on a pool of up to `num_jobs_`
+   *  threads, each with its own probe referee. A round finds the first of
+   *  `count` cases for which `fails(probe, index)` is true, trying cases in
+   *  order, and passes it to `next`, or `count` if no case fails. `next`
+   *  returns the number of cases in the following round, or 0 to stop; it
+   *  runs once every probe of the round has finished.
+   */
+  template <typename Fails, typename Next>
+  void search_failures(size_t count, Fails fails, Next next) {
+    TaskPool pool{static_cast<unsigned>(
+        std::max<size_t>(1, std::min<size_t>(num_jobs_, count)))};
+    std::vector<std::unique_ptr<TestReferee>> probes;
+    for (; probes.size() < pool.size();) {
+      probes.emplace_back(new TestReferee);
+      probes.back()->configure_worker(*this);
+      probes.back()->verbose_ = false;
+      probes.back()->compact_ = true;
+      probes.back()->expand_all_ = false;
     }
+    std::mutex mutex;
+    std::atomic<size_t> next_index{0}, first{count};
+    unsigned running = 0;
+    std::function<void()> start_round;
+    const TaskPool::task_fn work = [&](unsigned worker) {
+      for (size_t index = next_index++; index < first.load();
+           index = next_index++) {
+        if (fails(*probes[worker], index)) {
+          size_t seen = first.load();
+          while (index < seen && !first.compare_exchange_weak(seen, index)) {
+          }
+        }
+      }
+      std::lock_guard<std::mutex> lock{mutex};
+      if (--running == 0) {
+        count = next(first.load());
+        start_round();
+      }
+    };
+    // Queue a task per worker for the round; mutex must be held after the
+    // first round.
+    start_round = [&] {
+      if (count == 0) {
+        return;
+      }
+      next_index = 0;
+      first = count;
+      running = pool.size();
+      for (unsigned worker = 0; worker < pool.size(); ++worker) {
+        pool.push(work, worker);
+      }
+    };
+    start_round();
+    pool.run();
   }
 
-  void push_exception(std::exception_ptr excep, NodeType type, Status status,
-                      std::string expr_str, uint32_t line) {
-    push_node(type, status, rethrow_get_info(excep), line, expr_str);
+  static bool is_test(const TestNode &node) { return is_test_type(node.type); }
+  static bool is_failed_benchmark(const TestNode &node) {
+    return node.type == NodeType::Benchmark && node.status == Status::Fail;
+  }
+  static bool is_failed_test(const TestNode &node) {
+    return is_test_type(node.type) && node.status == Status::Fail;
+  }
+  //! A block registered by PROPERTY, whose tags start with "property".
+  bool is_property(const TestNode &block) const {
+    return block.tags_begin < block.tags_end &&
+           tags_[block.tags_begin] == "property";
   }
 
-  void run_block(void (*block)(), uint32_t node_id) {
-    block();
+  //! A block or section run, and its path, for the durations report.
+  struct TimedNode {
+    Timing time;
+    uint64_t rerun_ns;
+    uint64_t saved_ns;
+    AllocationStats allocations;
+    std::string path;
+  };
 
-    while (!next_section_.empty()) {
-      node_stack_.clear();
-      node_stack_.emplace_back(node_id);
-      const uint32_t section_end = nodes_.size() - 1;
-      exiting_ = false;
-      level_ = 0;
-      block();
-      nodes_[section_end + 1].new_run = true;
+  //! Collect every section run below a container, with its path.
+  void collect_sections(const TestNode &container, const std::string &path,
+                        std::vector<TimedNode> &sections) const {
+    for (const auto child : container) {
+      const TestNode &node = nodes_[child];
+      if (node.type == NodeType::Section) {
+        sections.push_back(
+            TimedNode{node.time, node.rerun_ns, node.saved_ns,
+                      node.allocations, path + " / " + node.expr.str()});
+        collect_sections(node, sections.back().path, sections);
+      }
     }
   }
 
-  void draw_indent(const char *indent_str) const {
-    for (int i = 0; i < level_; ++i) {
-      std::cout << indent_str;
+  //! Sort by descending wall time, keeping the order of ties, and truncate.
+  static void keep_slowest(std::vector<TimedNode> &rows, size_t count) {
+    std::stable_sort(rows.begin(), rows.end(),
+                     [](const TimedNode &lhs, const TimedNode &rhs) {
+                       return lhs.time.wall_ns > rhs.time.wall_ns;
+                     });
+    if (rows.size() > count) {
+      rows.erase(rows.begin() + count, rows.end());
     }
   }
 
-  //! Print the details of a TestNode.
-  void describe_node(const TestNode &node) const {
-    if (node.type == NodeType::Section) {
-      draw_indent("  ");
-    } else {
-      draw_indent("  ");
-      if (level_ != 0)
-        std::cout << "| ";
+  //! Print a table of the slowest blocks and sections, by wall time.
+  void describe_durations(uint32_t num_blocks) {
+    std::vector<TimedNode> blocks;
+    uint64_t rerun_ns = 0, saved_ns = 0;
+    for (uint32_t node_id = 0; node_id < num_blocks; ++node_id) {
+      const TestNode &block = nodes_[node_id];
+      blocks.push_back(TimedNode{block.time, block.rerun_ns, block.saved_ns,
+                                 block.allocations, block.expr.str()});
+      rerun_ns += block.rerun_ns;
+      saved_ns += block.saved_ns;
     }
-
-    switch (node.type) {
-    case NodeType::Block:
-      std::cout << CLIAttr::Bold << "----------[ ";
-      std::cout << node.expr << " ]----------";
-      break;
-    case NodeType::Section:
-      std::cout << "\\- ";
-      std::cout << ((node.status == Status::Succeed) ? CLIAttr::Green
-                                                     : CLIAttr::Red);
-      std::cout << CLIAttr::Bold << node.expr;
-      break;
-    case NodeType::Fail:
-      std::cout << node.status;
-      std::cout << CLIAttr::Red << "FAIL invoked" << CLIAttr::Reset;
-      if (!node.expr.empty()) {
-        std::cout << ": " << node.expr;
-      }
-      break;
-    case NodeType::Pass:
-      std::cout << node.status;
-      std::cout << CLIAttr::Green << "PASS invoked" << CLIAttr::Reset;
-      if (!node.expr.empty()) {
-        std::cout << ": " << node.expr;
-      }
-      break;
-    case NodeType::Notice:
-      std::cout << CLIAttr::Reset << "NOTICE: " << node.expr;
-      break;
-    case NodeType::Warn:
-      std::cout << CLIAttr::Red << "[ WARN ] " << node.expr;
-      std::cout << CLIAttr::Reset;
-      break;
-    case NodeType::Throws:
-    case NodeType::ThrowsAs:
-      std::cout << node.status;
-      std::cout << "with expression " << node.type;
-      std::cout << "(" << node.tags[0] << ") throwing \'" << node.expr << "\'";
-      std::cout << ", line " << node.line;
-      break;
-    case NodeType::NoThrow:
-      std::cout << node.status;
-      std::cout << "without exception '" << node.expr;
-      std::cout << "', line " << node.line;
-      break;
-    case NodeType::ThrowsUnexpected:
-      std::cout << node.status;
-      std::cout << "with unexpected exception '" << node.expr;
-      std::cout << "', line " << node.line;
-      break;
-    case NodeType::ThrowsOutOfNode:
-      std::cout << node.status;
-      std::cout << "with unexpected exception '" << node.expr;
-      std::cout << "', at some point after line " << node.line;
-      break;
-    default:
-      std::cout << node.status;
-      std::cout << "with expression " << node.type;
-      std::cout << "(" << node.tags[0];
-      std::cout << "), line " << node.line;
-      if (node.status == Status::Fail || expand_all_) {
-        std::cout << std::endl;
-        draw_indent("  ");
-        if (level_ != 0) {
-          std::cout << "| ";
+    keep_slowest(blocks, num_durations_);
+    keep_slowest(slowest_sections_, num_durations_);
+    const bool show_saved = saved_ns > 0;
+    const bool show_allocations = allocations_tracked();
+    const auto print_table = [this, show_saved, show_allocations](
+                                 const char *title,
+                                 const std::vector<TimedNode> &rows,
+                                 bool show_rerun) {
+      out_ << CLIAttr::Bold << title << CLIAttr::Reset << '\n';
+      out_ << "     wall (s)     cpu (s)" << (show_rerun ? "  re-run (s)" : "")
+           << (show_rerun && show_saved ? "   saved (s)" : "")
+           << (show_allocations ? "      allocs       bytes  peak bytes" : "")
+           << "  name\n";
+      for (const auto &row : rows) {
+        out_ << std::fixed << std::setprecision(6) << std::setw(13)
+             << seconds(row.time.wall_ns) << std::setw(12)
+             << seconds(row.time.cpu_ns);
+        if (show_rerun) {
+          out_ << std::setw(12) << seconds(row.rerun_ns);
+        }
+        if (show_rerun && show_saved) {
+          out_ << std::setw(12) << seconds(row.saved_ns);
+        }
+        if (show_allocations) {
+          out_ << std::setw(12) << row.allocations.count << std::setw(12)
+               << row.allocations.bytes << std::setw(12)
+               << row.allocations.peak_bytes;
         }
-        std::cout << "                         '" << node.expr;
-        std::cout << "'";
+        out_ << "  " << row.path << '\n';
       }
-      break;
+      out_ << '\n';
+    };
+    print_table("Slowest blocks:", blocks, true);
+    if (!slowest_sections_.empty()) {
+      print_table("Slowest section runs:", slowest_sections_, false);
     }
-    std::cout << CLIAttr::Reset << std::endl;
+    out_ << "Time spent re-running code above sections: " << std::fixed
+         << std::setprecision(6) << seconds(rerun_ns) << " s\n";
+    if (show_saved) {
+      out_ << "Time saved by copying fixtures instead of rebuilding them: "
+           << seconds(saved_ns) << " s\n";
+    }
+    out_ << '\n';
+    out_.unsetf(std::ios::floatfield);
   }
 
-  //! Rethrow an exception_ptr and display the details for that exception.
-  std::string rethrow_get_info(std::exception_ptr excep) const {
-    try {
-      if (excep) {
-        std::rethrow_exception(excep);
+  //! Print a table of the hardware events counted over each block.
+  void describe_perf(uint32_t num_blocks) {
+    static const char *const headings[PerfCounts::NUM_EVENTS] = {
+        "      cycles", "instructions", "cache misses", "branch misses"};
+    out_ << CLIAttr::Bold << "Hardware counters:" << CLIAttr::Reset << '\n';
+    for (uint32_t event = 0; event < PerfCounts::NUM_EVENTS; ++event) {
+      if (perf_events_ & (1u << event)) {
+        out_ << "  " << headings[event];
       }
-    } catch (const std::exception &e) {
-      return e.what();
-    } catch (...) {
-      return "unknown exception";
     }
-    return "no exception";
+    out_ << ((perf_events_ & 3u) == 3u ? "    IPC" : "") << "  name\n";
+    for (uint32_t node_id = 0; node_id < num_blocks; ++node_id) {
+      const PerfCounts &perf = nodes_[node_id].perf;
+      for (uint32_t event = 0; event < PerfCounts::NUM_EVENTS; ++event) {
+        if (perf_events_ & (1u << event)) {
+          out_ << "  " << std::setw(std::strlen(headings[event]))
+               << perf.values[event];
+        }
+      }
+      if ((perf_events_ & 3u) == 3u) {
+        out_ << std::fixed << std::setprecision(2) << std::setw(7)
+             << (perf.values[PerfCounts::CYCLES] > 0
+                     ? static_cast<double>(
+                           perf.values[PerfCounts::INSTRUCTIONS]) /
+                           perf.values[PerfCounts::CYCLES]
+                     : 0.0);
+        out_.unsetf(std::ios::floatfield);
+      }
+      out_ << "  " << nodes_[node_id].expr << '\n';
+    }
+    out_ << '\n';
   }
 
-  /**  Push a section into the section stack, and increase the level. If
-   *   we're entering this section to navigate to a leaf node section,
-   *   push a TestNode for the section. If we're exiting from a leaf
-   *   node, store this as the next leaf node to be executed.
-   */
-  bool push_section(uint32_t line_number, std::string name) {
-    section_stack_.emplace_back(line_number);
-    const bool must_descend_further =
-        static_cast<size_t>(level_) >= next_section_.size();
-    const bool reached_leaf_node =
-        static_cast<size_t>(level_) < next_section_.size() &&
-        next_section_[level_] == line_number;
-    if (!exiting_ &&
-        (next_section_.empty() || must_descend_further || reached_leaf_node)) {
-      push_node(NodeType::Section, Status::Null, name, line_number);
-      ++level_;
-      return true;
-    } else if (exiting_ && next_section_.empty()) {
-      next_section_.reserve(section_stack_.size());
-      std::copy(section_stack_.begin(), section_stack_.end(),
-                std::back_inserter(next_section_));
+  //! Print a table of the statistics of every benchmark which ran.
+  void describe_benchmarks() {
+    out_ << CLIAttr::Bold << "Benchmarks:" << CLIAttr::Reset << '\n';
+    out_ << std::setw(14) << "mean" << std::setw(14) << "median"
+         << std::setw(14) << "stddev" << std::setw(14) << "min"
+         << std::setw(18) << "samples x iters" << std::setw(10) << "outliers"
+         << "  name\n";
+    for (size_t i = 0; i < benchmarks_.size(); ++i) {
+      const BenchmarkStats &stats = benchmarks_[i].stats;
+      std::ostringstream counts;
+      counts << stats.samples << " x " << stats.iterations;
+      out_ << std::setw(14) << format_ns(stats.mean) << std::setw(14)
+           << format_ns(stats.median) << std::setw(14)
+           << format_ns(stats.stddev) << std::setw(14) << format_ns(stats.min)
+           << std::setw(18) << counts.str() << std::setw(10) << stats.outliers
+           << "  " << benchmark_names_[i] << '\n';
     }
-    ++level_;
-    return false;
+    out_ << '\n';
   }
 
-  /**  Pop a section from the section stack, and decrease the level. If
-   *   we're exiting from a leaf node, clear the next_section_ record
-   *   and set the exiting_ flag.
+  /** Fail a benchmark whose median is more than `threshold_` percent slower
+   *  than its baseline, where the 95% CIs of the two medians do not overlap.
+   *  The CI of the change is the conservative ratio of the bounds.
    */
-  void pop_section(bool can_run) {
-    section_stack_.pop_back();
-    --level_;
-    if (can_run && !exiting_) {
-      next_section_.clear();
-      exiting_ = true;
+  void compare_baseline(const BenchmarkResult &benchmark, StringRef name) {
+    const auto found = baseline_.find(name.str());
+    if (found == baseline_.end() || found->second.median <= 0.0) {
+      return;
     }
+    const Baseline &base = found->second;
+    const BenchmarkStats &stats = benchmark.stats;
+    const double change = 100.0 * (stats.median / base.median - 1.0);
+    if (change <= threshold_ || stats.median_low <= base.high) {
+      return;
+    }
+    TestNode &node = nodes_[benchmark.node];
+    std::ostringstream os;
+    os << node.source << "\nmedian regressed by " << std::fixed
+       << std::setprecision(1) << change << "% (95% CI "
+       << 100.0 * (stats.median_low / base.high - 1.0) << "% to "
+       << 100.0 * (stats.median_high / base.low - 1.0)
+       << "%) against baseline " << format_ns(base.median) << ", threshold "
+       << threshold_ << "%";
+    node.source = text_.store(os.str());
+    node.status = Status::Fail;
   }
 
-  TestNode &lastNode() {
-    static TestNode null{NodeType::Warn, Status::Null,
-                         "lastNode() called on empty TestReferee", __LINE__};
-    if (nodes_.empty()) {
-      return null;
+  //! Write the median of each benchmark, in the --compare-baseline format.
+  void save_baseline() {
+    std::ofstream file{baseline_path_};
+    file << std::setprecision(9);
+    for (size_t i = 0; i < benchmarks_.size(); ++i) {
+      const BenchmarkStats &stats = benchmarks_[i].stats;
+      file << stats.median << " " << stats.median_low << " "
+           << stats.median_high << " " << benchmark_names_[i] << "\n";
+    }
+    if (!file) {
+      out_ << CLIAttr::Red << "Could not write baseline to " << baseline_path_
+           << CLIAttr::Reset << '\n';
     }
-    return nodes_.back();
   }
 
-private:
-  static bool is_test(const TestNode &node) {
-    return node.type <= NodeType::Pass;
+  //! Keep a finished block's result for the result cache and timings file.
+  void record_result(const TestNode &block) {
+    if (!cache_path_.empty()) {
+      cache_[block.expr.str()] =
+          CachedResult{build_id_.empty() ? "unknown" : build_id_,
+                       block.status != Status::Fail,
+                       seconds(block.time.wall_ns)};
+    }
+    if (!timings_path_.empty()) {
+      block_times_.emplace_back(block.expr, block.time.wall_ns);
+    }
   }
-  static bool is_failed_block(const TestNode &node) {
-    return node.type == NodeType::Block && node.status == Status::Fail;
+
+  //! Write the wall time of each block, in the --shard-timings format.
+  void save_timings() {
+    std::ofstream file{timings_path_};
+    file << std::setprecision(9);
+    for (const auto &time : block_times_) {
+      file << seconds(time.second) << " " << time.first << "\n";
+    }
+    if (!file) {
+      out_ << CLIAttr::Red << "Could not write timings to " << timings_path_
+           << CLIAttr::Reset << '\n';
+    }
   }
-  static bool is_failed_test(const TestNode &node) {
-    return node.type <= NodeType::Pass && node.status == Status::Fail;
+
+  //! Check a registered block against the tags of -t or -x and the path of -s.
+  bool is_selected(uint32_t block_id) const {
+    return (tag_filter_.empty() ||
+            tag_filter_.matches(block_tags_[block_id])) &&
+           (select_path_.empty() ||
+            glob_match(select_path_[0], nodes_[block_id].expr));
   }
-  static bool node_failed(const TestNode &node) {
-    return node.status == Status::Fail;
+
+  //! Check a section at the current level against the path given with -s.
+  bool is_selected_section(StringRef name) const {
+    const size_t depth =
+        1 + std::count_if(section_stack_.begin(), section_stack_.end(),
+                          [](const PathStep &step) { return step.count == 0; });
+    return depth >= select_path_.size() ||
+           glob_match(select_path_[depth], name);
   }
-  static bool any_node(const TestNode &) { return true; }
 
-  /** Describe and enumerate the children of any node fitting the
-   *  supplied predicate.
-   */
-  void enumerate_children(const TestNode &node, NodePredicate predicate) {
+  //! Return the ID of a tag, interning it if it is new.
+  uint32_t intern_tag(StringRef tag) {
+    const auto inserted = tag_ids_.emplace(
+        tag.str(), static_cast<uint32_t>(tag_names_.size()));
+    if (inserted.second) {
+      tag_names_.push_back(tag);
+    }
+    return inserted.first->second;
+  }
 
-    for (auto iter = node.begin(); iter != node.end(); ++iter) {
-      auto &child_node = nodes_[*iter];
-      if (predicate(child_node)) {
-        if (child_node.new_run) {
-          std::cout << std::endl;
-          level_ = 0;
+  //! Print the name, file, line and tags of each selected block.
+  void list_blocks(uint32_t num_blocks) {
+    for (uint32_t block = 0; block < num_blocks; ++block) {
+      const TestNode &node = nodes_[block];
+      if (!list_json_) {
+        out_ << node.expr << "\t" << node.source << ":" << node.line << "\t";
+        for (uint32_t tag = node.tags_begin; tag < node.tags_end; ++tag) {
+          out_ << (tag == node.tags_begin ? "" : ";") << tags_[tag];
         }
+        out_ << "\n";
+        continue;
+      }
+      out_ << "{\"block\":";
+      write_json(out_, node.expr);
+      out_ << ",\"file\":";
+      write_json(out_, node.source);
+      out_ << ",\"line\":" << node.line << ",\"tags\":[";
+      for (uint32_t tag = node.tags_begin; tag < node.tags_end; ++tag) {
+        out_ << (tag == node.tags_begin ? "" : ",");
+        write_json(out_, tags_[tag]);
+      }
+      out_ << "]}\n";
+    }
+  }
 
-        describe_node(child_node);
-        if (child_node.type == NodeType::Section) {
-          ++level_;
+  //! Print the tags of the selected blocks, with how many blocks have each.
+  void list_tags(uint32_t num_blocks) {
+    std::vector<uint32_t> counts(tag_names_.size(), 0);
+    std::vector<uint32_t> counted_by(tag_names_.size(), num_blocks);
+    for (uint32_t block = 0; block < num_blocks; ++block) {
+      const TestNode &node = nodes_[block];
+      for (uint32_t tag = node.tags_begin; tag < node.tags_end; ++tag) {
+        const uint32_t id = tag_ids_.find(tags_[tag].str())->second;
+        if (counted_by[id] != block) {
+          counted_by[id] = block;
+          ++counts[id];
         }
+      }
+    }
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 0; id < counts.size(); ++id) {
+      if (counts[id] > 0) {
+        ids.push_back(id);
+      }
+    }
+    std::sort(ids.begin(), ids.end(), [this](uint32_t lhs, uint32_t rhs) {
+      return std::lexicographical_compare(
+          tag_names_[lhs].begin(), tag_names_[lhs].end(),
+          tag_names_[rhs].begin(), tag_names_[rhs].end());
+    });
+    for (const uint32_t id : ids) {
+      if (list_json_) {
+        out_ << "{\"tag\":";
+        write_json(out_, tag_names_[id]);
+        out_ << ",\"blocks\":" << counts[id] << "}\n";
+      } else {
+        out_ << tag_names_[id] << "\t" << counts[id] << "\n";
+      }
+    }
+  }
 
-        enumerate_children(child_node, predicate);
-        if (child_node.type == NodeType::Section) {
-          --level_;
-        }
+  //! Return the set of registered tags matching a tag, with wildcards.
+  TagSet resolve_tags(StringRef pattern) const {
+    TagSet tags;
+    if (std::find_if(pattern.begin(), pattern.end(), [](char c) {
+          return c == '*' || c == '?';
+        }) == pattern.end()) {
+      const auto found = tag_ids_.find(pattern.str());
+      if (found != tag_ids_.end()) {
+        tags.insert(found->second);
+      }
+      return tags;
+    }
+    for (uint32_t id = 0; id < tag_names_.size(); ++id) {
+      if (glob_match(pattern, tag_names_[id])) {
+        tags.insert(id);
       }
     }
+    return tags;
   }
 
-  /** Return true if a node matches the stored tags, based on the current
-   *  TagMatchMode.
+  /** Keep only the blocks assigned to this shard. Blocks are assigned by a
+   *  hash of their name or, given recorded durations, by greedily packing
+   *  the longest blocks into the least-loaded shard. Either way every shard
+   *  computes the same assignment, so the shards partition the run.
    */
-  bool matches_tags(const TestNode &node) {
-    if (node.tags.empty())
-      return false;
-    if (tag_match_mode_ == TagMatchMode::Any) {
-      for (const auto &tag : filter_tags_) {
-        if (std::find(node.tags.begin(), node.tags.end(), tag) !=
-            node.tags.end()) {
-          return true;
-        }
+  void select_shard() {
+    std::vector<uint32_t> shard_of(nodes_.size());
+    if (shard_timings_.empty()) {
+      for (size_t node_id = 0; node_id < nodes_.size(); ++node_id) {
+        shard_of[node_id] = hash_string(nodes_[node_id].expr) % shard_count_;
       }
-      return false;
     } else {
-      for (const auto &tag : filter_tags_) {
-        if (std::find(node.tags.begin(), node.tags.end(), tag) ==
-            node.tags.end()) {
-          return false;
+      std::vector<double> durations(nodes_.size(), -1.0);
+      double total = 0.0;
+      size_t num_known = 0;
+      for (size_t node_id = 0; node_id < nodes_.size(); ++node_id) {
+        const auto found = shard_timings_.find(nodes_[node_id].expr.str());
+        if (found != shard_timings_.end()) {
+          durations[node_id] = found->second;
+          total += found->second;
+          ++num_known;
         }
       }
-      return true;
+      const double fallback = num_known ? total / num_known : 1.0;
+      std::vector<uint32_t> order(nodes_.size());
+      for (size_t node_id = 0; node_id < nodes_.size(); ++node_id) {
+        order[node_id] = node_id;
+        if (durations[node_id] < 0.0) {
+          durations[node_id] = fallback;
+        }
+      }
+      std::stable_sort(order.begin(), order.end(),
+                       [&durations](uint32_t lhs, uint32_t rhs) {
+                         return durations[lhs] > durations[rhs];
+                       });
+      std::vector<double> loads(shard_count_, 0.0);
+      for (const auto node_id : order) {
+        const auto lightest = std::min_element(loads.begin(), loads.end());
+        shard_of[node_id] = lightest - loads.begin();
+        *lightest += durations[node_id];
+      }
+    }
+    size_t kept = 0;
+    for (size_t node_id = 0; node_id < nodes_.size(); ++node_id) {
+      if (shard_of[node_id] == shard_index_) {
+        nodes_[kept++] = std::move(nodes_[node_id]);
+      }
+    }
+    nodes_.erase(nodes_.begin() + kept, nodes_.end());
+  }
+
+  /** Apply the result cache to the selected blocks. With --last-failed,
+   *  only the blocks which failed when last run are kept, unless none did;
+   *  with --only-changed, blocks which passed when last run by this build
+   *  are dropped. With --failed-first, blocks which failed when last run
+   *  are moved to the front, keeping their order.
+   */
+  void select_cached() {
+    read_cache(cache_path_, cache_);
+    build_id_ = build_id(exe_path_);
+    const auto failed = [this](const TestNode &block) {
+      const auto found = cache_.find(block.expr.str());
+      return found != cache_.end() && !found->second.passed;
+    };
+    const auto unchanged = [this](const TestNode &block) {
+      const auto found = cache_.find(block.expr.str());
+      return !build_id_.empty() && found != cache_.end() &&
+             found->second.passed && found->second.build == build_id_;
+    };
+    const size_t num_selected = nodes_.size();
+    if (cache_select_ == CacheSelect::LastFailed &&
+        std::any_of(nodes_.begin(), nodes_.end(), failed)) {
+      nodes_.erase(std::remove_if(nodes_.begin(), nodes_.end(),
+                                  [&failed](const TestNode &block) {
+                                    return !failed(block);
+                                  }),
+                   nodes_.end());
+    } else if (cache_select_ == CacheSelect::LastFailed &&
+               list_mode_ == ListMode::None) {
+      out_ << "No failed blocks in " << cache_path_
+           << "; running all selected blocks.\n\n";
+    } else if (cache_select_ == CacheSelect::OnlyChanged) {
+      nodes_.erase(std::remove_if(nodes_.begin(), nodes_.end(), unchanged),
+                   nodes_.end());
+    }
+    num_cached_ = num_selected - nodes_.size();
+  }
+
+  /** Put the selected blocks in the order given by --order: as declared,
+   *  shuffled by --seed, or by descending wall time in the result cache,
+   *  where blocks without a recorded time are taken to be of average
+   *  length. Then, with --failed-first, move the blocks which failed when
+   *  last run to the front, keeping their order.
+   */
+  void order_blocks() {
+    if (block_order_ == BlockOrder::Random) {
+      if (list_mode_ == ListMode::None) {
+        out_ << "Running blocks in random order, with --seed " << seed_
+             << ".\n\n";
+      }
+      std::mt19937_64 rng{mix_seed(seed_)};
+      for (size_t i = nodes_.size(); i > 1; --i) {
+        std::swap(nodes_[i - 1], nodes_[rng() % i]);
+      }
+    } else if (block_order_ == BlockOrder::LongestFirst) {
+      double total = 0.0;
+      size_t num_known = 0;
+      for (const auto &block : nodes_) {
+        const auto found = cache_.find(block.expr.str());
+        if (found != cache_.end()) {
+          total += found->second.seconds;
+          ++num_known;
+        }
+      }
+      const double fallback = num_known ? total / num_known : 0.0;
+      std::vector<std::pair<double, uint32_t>> order;
+      for (size_t node_id = 0; node_id < nodes_.size(); ++node_id) {
+        const auto found = cache_.find(nodes_[node_id].expr.str());
+        order.emplace_back(found != cache_.end() ? found->second.seconds
+                                                 : fallback,
+                           node_id);
+      }
+      std::stable_sort(order.begin(), order.end(),
+                       [](const std::pair<double, uint32_t> &lhs,
+                          const std::pair<double, uint32_t> &rhs) {
+                         return lhs.first > rhs.first;
+                       });
+      std::vector<TestNode> blocks;
+      blocks.reserve(nodes_.size());
+      for (const auto &entry : order) {
+        blocks.push_back(std::move(nodes_[entry.second]));
+      }
+      nodes_.swap(blocks);
+    }
+    if (failed_first_) {
+      std::stable_partition(
+          nodes_.begin(), nodes_.end(), [this](const TestNode &block) {
+            const auto found = cache_.find(block.expr.str());
+            return found != cache_.end() && !found->second.passed;
+          });
+    }
+  }
+
+  //! Save the result cache, with the result of each block run.
+  void save_cache() {
+    std::vector<const std::pair<const std::string, CachedResult> *> entries;
+    for (const auto &entry : cache_) {
+      entries.push_back(&entry);
     }
+    std::sort(entries.begin(), entries.end(),
+              [](const std::pair<const std::string, CachedResult> *lhs,
+                 const std::pair<const std::string, CachedResult> *rhs) {
+                return lhs->first < rhs->first;
+              });
+    std::ofstream file{cache_path_};
+    file << std::setprecision(9);
+    for (const auto *entry : entries) {
+      file << entry->second.build << " " << (entry->second.passed ? "P" : "F")
+           << " " << entry->second.seconds << " " << entry->first << "\n";
+    }
+    if (!file) {
+      out_ << CLIAttr::Red << "Could not write result cache to "
+           << cache_path_ << CLIAttr::Reset << '\n';
+    }
+  }
+
+  /** Count a passing test against the site made up of its enclosing
+   *  container and line, rather than storing a node for it.
+   */
+  void count_pass(NodeType type, uint32_t line) {
+    const uint32_t container = node_stack_.empty() ? 0 : node_stack_.back();
+    if (last_site_ < pass_sites_.size()) {
+      PassSite &last = pass_sites_[last_site_];
+      if (last.container == container && last.line == line) {
+        ++last.count;
+        return;
+      }
+    }
+    const uint64_t key = (static_cast<uint64_t>(container) << 32) | line;
+    const auto found = site_index_.emplace(key, pass_sites_.size());
+    if (found.second) {
+      pass_sites_.push_back(PassSite{container, line, type, 0});
+    }
+    last_site_ = found.first->second;
+    ++pass_sites_[last_site_].count;
   }
 
   /** Get the status for a block of tests based on whether or not
@@ -786,65 +5538,209 @@ private:
   }
 
   std::vector<TestNode> nodes_; //<! List of cases, sections and assertions.
-  std::vector<std::string> filter_tags_; //<! Tags to filter cases on.
+  std::vector<StringRef> tags_;        //<! Tags of all registered blocks.
+  std::unordered_map<std::string, uint32_t>
+      tag_ids_;                        //<! ID of each interned tag.
+  std::vector<StringRef> tag_names_;   //<! Interned tags, by ID.
+  std::vector<TagSet> block_tags_; //<! Interned tags of each registered block.
+  TextPool text_;                      //<! Text built at run time.
+  TextPool names_; //<! Anonymous block names and benchmark names.
+  TagExpression tag_filter_;           //<! The -t and -x expressions.
+  std::vector<StringRef> select_path_; //<! Block and section name globs.
   std::vector<uint32_t>
       node_stack_; //<! Stack of nodes for determining status inheritance.
-  std::vector<uint32_t> section_stack_; //<! Stack of sections indicating path
+  std::vector<PathStep> section_stack_; //<! Stack of sections indicating path
                                         //through current case.
-  std::vector<uint32_t> next_section_;  //<! Path to next active section.
+  std::vector<PathStep> next_section_;  //<! Path to next active section.
+  std::vector<PathStep> run_prefix_;    //<! Path every run must stay under.
+  std::function<void(const std::vector<PathStep> &)>
+      split_values_; //<! Takes the other values of a split generator.
+  std::vector<SectionTimer> section_timers_; //<! Timers of entered sections.
+  std::vector<PassSite> pass_sites_;    //<! Passing tests, in compact mode.
+  std::unordered_map<uint64_t, uint32_t>
+      site_index_; //<! Index into pass_sites_ by container and line.
+  std::vector<BenchmarkResult> benchmarks_; //<! Results of benchmarks.
+  std::vector<StringRef> benchmark_names_; //<! "block / name" of each.
+  std::vector<TimedNode> slowest_sections_; //<! Slowest section runs so far.
+  RunTotals totals_;    //<! Counts of the blocks finished so far.
+  uint32_t num_blocks_; //<! Number of blocks selected to run.
+  std::unordered_map<std::string, double>
+      shard_timings_;     //<! Recorded block durations, for sharding.
+  std::string timings_path_; //<! File to save block durations to.
+  std::vector<std::pair<StringRef, uint64_t>>
+      block_times_; //<! Name and wall time of each finished block.
+  uint64_t rerun_ns_;        //<! Re-run time of the current block.
+  uint64_t saved_ns_;        //<! Fixture setup saved in the current block.
+  uint64_t fixture_ns_;      //<! Time taken to build the current fixture.
+  std::shared_ptr<void> fixture_; //<! Fixture of the current block, if any.
+  uint64_t leaf_ns_;         //<! Time spent in leaf sections this run.
+  uint32_t last_site_;       //<! Index of the most recently counted site.
+  uint32_t last_line_;       //<! Line of the most recent node.
+  uint32_t sections_entered_; //<! Count of sections entered, for timing.
+  uint32_t blocks_matched_; //<! Blocks reaching every section given by -s.
+  unsigned num_jobs_;        //<! Number of blocks to run in parallel.
+  unsigned shard_index_;     //<! Index of the shard to run, from 0.
+  unsigned shard_count_;     //<! Number of shards the blocks are split into.
+  unsigned num_durations_;   //<! Number of slowest blocks to report.
+  uint32_t benchmark_samples_; //<! Samples to take for each benchmark.
+  uint64_t seed_;              //<! Seed for generating property cases.
+  uint32_t property_cases_;    //<! Cases to run for each property.
+  uint32_t perf_events_;       //<! Mask of the hardware events counted.
+  uint64_t timeout_ns_;        //<! Time limit of each block, or 0.
+  uint64_t block_timeout_ns_;  //<! Time limit of the running block, or 0.
+  std::atomic<uint64_t> deadline_ns_; //<! When the running block times out.
+  std::mutex progress_mutex_; //<! Guards the progress and the deadline.
+  std::string progress_;      //<! Path of the running block and sections.
+  uint64_t progress_timeout_ns_; //<! Time limit of the block in progress_.
+  TestNode progress_block_; //<! Copy of the block in progress_.
+  char *shared_progress_; //<! Copy of progress_ read by a worker's parent.
+  std::mutex report_mutex_; //<! Held while a block is being reported.
+  std::string cache_path_;  //<! Result cache file, or empty.
+  std::unordered_map<std::string, CachedResult>
+      cache_;               //<! Results of earlier runs, by block name.
+  std::string build_id_;    //<! ID of this build, or empty if unknown.
+  const char *exe_path_;    //<! Path the program was run as.
+  size_t num_cached_;       //<! Blocks left out by the result cache.
+  CacheSelect cache_select_; //<! Blocks to run, given the result cache.
+  bool failed_first_; //<! Run blocks which failed when last run first.
+  BlockOrder block_order_; //<! Order to run the selected blocks in.
+  ListMode list_mode_; //<! What to list instead of running the blocks.
+  bool list_json_;     //<! List as JSON Lines, with --list-format json.
+  std::unordered_map<std::string, Baseline>
+      baseline_;              //<! Benchmark medians to compare against.
+  std::string baseline_path_; //<! File to save benchmark medians to.
+  double threshold_;          //<! Tolerated slowdown of a median, in %.
 
   int level_;                   //<! Nested section depth.
-  TagMatchMode tag_match_mode_; //<! Current tag-matching mode.
+  Status last_status_;          //<! Status of the most recent node.
   bool expand_all_;             //<! Whether or not to expand all expressions.
   bool exiting_; //<! Indicates movement out of an active section.
   bool verbose_; //<! Verbose mode flag.
+  bool compact_; //<! Count passing tests instead of storing their nodes.
+  bool isolate_; //<! Run blocks in forked worker processes.
+  bool perf_counters_; //<! Count hardware events, with --perf-counters.
+  bool watch_progress_; //<! Track progress_, as some block has a time limit.
+  ChunkedBuffer output_;  //<! Buffer of stdout, for reports.
+  std::ostream out_;      //<! Stream of reports to stdout.
+  std::unique_ptr<Reporter> reporter_; //<! Receives results of the run.
+  std::string report_format_; //<! Format of the report file, if any.
+  std::string report_path_;   //<! Path of the report file.
+  std::unique_ptr<std::ofstream> report_file_;
+  std::unique_ptr<Reporter> file_reporter_; //<! Writes the report file.
 };
 
+//! The referee of a worker thread, or null on the main thread.
+inline TestReferee *&thread_referee() {
+  static thread_local TestReferee *referee = nullptr;
+  return referee;
+}
+
 inline TestReferee &g_TestReferee() {
   static TestReferee global_test_referee;
-  return global_test_referee;
+  TestReferee *const worker = thread_referee();
+  return worker ? *worker : global_test_referee;
 }
 
-struct BlockLoader {
-  BlockLoader(NodeType type, Status status, payload_fn fn, const NameTags &data,
-              uint32_t line) {
-    g_TestReferee().push_node(type, status, data.name, line, data.tags, fn,
-                              true);
-  }
-};
-
-struct SectionLoader {
-  SectionLoader(uint32_t line_number, NameTags name_tags)
-      : can_run_{cataplasm::g_TestReferee().push_section(line_number,
-                                                         name_tags.name)},
-        name_{name_tags.name}, line_{line_number} {}
-  ~SectionLoader() { g_TestReferee().pop_section(can_run_); }
-  operator bool() const { return can_run_; }
-
-  bool can_run_;
-  std::string name_;
-  uint32_t line_;
-};
-
 inline void print_help(const char *exe_name, const std::string &msg) {
+  detect_colour(std::cout, stdout);
   if (!msg.empty()) {
     std::cout << CLIAttr::Bold << "ERROR: " << msg;
     std::cout << CLIAttr::Reset << std::endl;
   }
   std::cout << std::endl << "USAGE:" << std::endl;
-  std::cout << exe_name << " [-h] [-t|-x TAGS] [-v]" << std::endl;
+  std::cout << exe_name << " [-h] [-t TAGS] [-x TAGS] [-s PATH] [-v] [-i]"
+            << " [-j JOBS] [--durations N] [--save-timings FILE]"
+            << " [--shard INDEX/COUNT [--shard-timings FILE]]"
+            << " [--benchmark-samples N] [--save-baseline FILE]"
+            << " [--compare-baseline FILE [--threshold PCT]]"
+            << " [--reporter junit|json --out FILE]"
+            << " [--seed N] [--property-cases N] [--perf-counters]"
+            << " [--timeout SECONDS] [--cache FILE]"
+            << " [--failed-first] [--last-failed|--only-changed]"
+            << " [--order decl|rand|longest-first]"
+            << " [--list-tests|--list-tags [--list-format text|json]]"
+            << std::endl;
   std::cout << std::endl << "Arguments:" << std::endl;
   std::cout << "\t-h        Prints this help message.\n";
   std::cout
       << "\t-e        Expand all expressions (also enables verbose mode).\n";
   std::cout << "\t-t TAGS   Run only test blocks having any of the specified "
-               "tags (semicolon-separated list).\n";
+               "tags (semicolon-separated list), or matching an expression "
+               "such as 'fast & !slow | (net & smoke)'.\n";
   std::cout << "\t-x TAGS   Run only test blocks having all of the specified "
-               "tags (semicolon-separated list).\n";
+               "tags (semicolon-separated list), or matching an expression.\n";
+  std::cout << "\t-s PATH   Run only the blocks and sections matching PATH "
+               "('block/section/...', with * and ? globs).\n";
   std::cout
       << "\t-v        Use verbose mode, printing the results of all tests.\n";
+  std::cout << "\t-i        Isolate test blocks in worker processes, so a "
+               "crash only fails its own block.\n";
+  std::cout << "\t-j JOBS   Run test blocks on JOBS threads, or JOBS worker "
+               "processes with -i (0 for one per core).\n";
+  std::cout << "\t--durations N\n"
+               "\t          Report the N slowest blocks and section runs.\n";
+  std::cout << "\t--save-timings FILE\n"
+               "\t          Save the duration of each block to FILE, for "
+               "--shard-timings.\n";
+  std::cout << "\t--shard INDEX/COUNT\n"
+               "\t          Run only shard INDEX of COUNT (from 1), after "
+               "filtering by tags.\n";
+  std::cout << "\t--shard-timings FILE\n"
+               "\t          Balance shards using block durations from FILE "
+               "('SECONDS NAME' per line).\n";
+  std::cout << "\t--benchmark-samples N\n"
+               "\t          Take N timed samples for each BENCHMARK (default "
+               "30).\n";
+  std::cout << "\t--save-baseline FILE\n"
+               "\t          Save the median of each BENCHMARK to FILE.\n";
+  std::cout << "\t--compare-baseline FILE\n"
+               "\t          Fail each BENCHMARK whose median is significantly "
+               "slower than in FILE.\n";
+  std::cout << "\t--threshold PCT\n"
+               "\t          Tolerate medians up to PCT percent slower than the "
+               "baseline (default 10).\n";
+  std::cout << "\t--reporter junit|json --out FILE\n"
+               "\t          Also write results to FILE as JUnit XML or JSON "
+               "Lines, as each block finishes.\n";
+  std::cout << "\t--seed N\n"
+               "\t          Generate PROPERTY cases, and shuffle blocks, from "
+               "seed N (random by default).\n";
+  std::cout << "\t--property-cases N\n"
+               "\t          Run N generated cases for each PROPERTY (default "
+               "100).\n";
+  std::cout << "\t--perf-counters\n"
+               "\t          Count cycles, instructions, cache misses and "
+               "branch misses per block and BENCHMARK (Linux).\n";
+  std::cout << "\t--timeout SECONDS\n"
+               "\t          Fail each block still running after SECONDS; "
+               "a 'timeout=SECONDS' tag overrides it.\n";
+  std::cout << "\t--cache FILE\n"
+               "\t          Record the status and duration of each block in "
+               "FILE (default .cataplasm-cache).\n";
+  std::cout << "\t--failed-first\n"
+               "\t          Run the blocks which failed when last run "
+               "first.\n";
+  std::cout << "\t--last-failed\n"
+               "\t          Run only the blocks which failed when last run, "
+               "or all if none did.\n";
+  std::cout << "\t--only-changed\n"
+               "\t          Skip the blocks which passed when last run by "
+               "this build.\n";
+  std::cout << "\t--order decl|rand|longest-first\n"
+               "\t          Run blocks as declared (default), shuffled, or "
+               "longest first by their times in the cache.\n";
+  std::cout << "\t--list-tests\n"
+               "\t          List the selected blocks, with their files, lines "
+               "and tags, without running them.\n";
+  std::cout << "\t--list-tags\n"
+               "\t          List the tags of the selected blocks, with how "
+               "many blocks have each.\n";
+  std::cout << "\t--list-format text|json\n"
+               "\t          List as tab-separated text (default) or as JSON "
+               "Lines.\n";
 }
 }
+#endif
 
 #ifdef CATAPLASM_CATCH
 #define REQUIRE(expr) ENSURE(expr)
@@ -874,8 +5770,217 @@ inline void print_help(const char *exe_name, const std::string &msg) {
 #define AND_THEN(desc) SECTION("     And: " desc, "")
 #endif
 
+#ifdef CATAPLASM_IMPLEMENTATION
+namespace cataplasm {
+//----[ Hook definitions ]------------------------------------------------------
+std::string stream_string(stream_fn fn, const void *value) {
+  std::ostringstream os;
+  fn(os, value);
+  return os.str();
+}
+
+std::string number_string(double value) {
+  std::ostringstream os;
+  os << value;
+  return os.str();
+}
+
+std::string number_string(long double value) {
+  std::ostringstream os;
+  os << value;
+  return os.str();
+}
+
+std::string pointer_string(const void *value) {
+  std::ostringstream os;
+  os << value;
+  return os.str();
+}
+
+Status push_result(NodeType type, Status pass, Status fail,
+                   const ExprResult &result, uint32_t line, const char *expr) {
+  return g_TestReferee().push_result(type, pass, fail, result, line, expr);
+}
+
+void push_exception(std::exception_ptr excep, NodeType type, Status status,
+                    const char *expr, uint32_t line) {
+  g_TestReferee().push_exception(excep, type, status, expr, line);
+}
+
+Status push_allocations(NodeType type, const AllocationStats &stats,
+                        uint64_t limit, uint32_t line, const char *expr) {
+  return g_TestReferee().push_allocations(type, stats, limit, line, expr);
+}
+
+void push_node(NodeType type, Status status, const char *expr, uint32_t line) {
+  g_TestReferee().push_node(type, status, expr, line);
+}
+
+void push_message(NodeType type, const std::string &message, uint32_t line) {
+  g_TestReferee().push_message(type, message, line);
+}
+
+Status last_status() { return g_TestReferee().last_status(); }
+
+uint32_t last_line() { return g_TestReferee().last_line(); }
+
+PathStep push_generator(uint32_t line, const char *expr, size_t count) {
+  return g_TestReferee().push_generator(line, expr, count);
+}
+
+void enter_generated(const char *expr, const std::string &value) {
+  g_TestReferee().enter_generated(expr, value);
+}
+
+const void *block_fixture(void *(*build)(), void (*destroy)(void *)) {
+  return g_TestReferee().block_fixture(build, destroy);
+}
+
+void run_property(PropertyCases &cases, const char *params) {
+  g_TestReferee().check_property(cases, params);
+}
+
+const char *store_property_tags(const char *tags) {
+  static TextPool pool;
+  return pool.store("property;" + std::string(tags)).data;
+}
+
+BlockLoader::BlockLoader(NodeType type, Status status, payload_fn fn,
+                         const NameTags &data, uint32_t line,
+                         const char *file) {
+  g_TestReferee().push_block(type, status, data, line, fn, file);
+}
+
+SectionLoader::SectionLoader(uint32_t line_number, NameTags name_tags)
+    : can_run_{g_TestReferee().push_section(line_number, name_tags.name)},
+      name_{name_tags.name}, line_{line_number} {}
+
+SectionLoader::~SectionLoader() { g_TestReferee().pop_section(); }
+
+BenchmarkRunner::BenchmarkRunner(uint32_t line, const char *name)
+    : name_{name}, line_{line}, iteration_{0}, batch_size_{0},
+      num_samples_{g_TestReferee().benchmark_samples()}, warming_up_{true},
+      count_perf_{g_TestReferee().perf_events() != 0}, start_ns_{0},
+      warmup_start_ns_{0}, perf_start_{}, samples_{} {}
+
+bool BenchmarkRunner::advance() {
+  const uint64_t now = now_ns();
+  if (batch_size_ == 0) {
+    batch_size_ = 1;
+    warmup_start_ns_ = now;
+    samples_.reserve(num_samples_);
+  } else if (warming_up_) {
+    if (now - start_ns_ < MIN_BATCH_NS && batch_size_ < MAX_BATCH_SIZE) {
+      batch_size_ *= 2;
+    } else if (now - warmup_start_ns_ >= WARMUP_NS) {
+      warming_up_ = false;
+      if (count_perf_) {
+        perf_start_ = PerfCounters::local().read();
+      }
+    }
+  } else {
+    samples_.push_back(static_cast<double>(now - start_ns_) / batch_size_);
+    if (samples_.size() >= num_samples_) {
+      BenchmarkStats stats = analyse_samples(std::move(samples_), batch_size_);
+      if (count_perf_) {
+        stats.perf = PerfCounters::local().read() - perf_start_;
+      }
+      g_TestReferee().push_benchmark(name_, line_, stats);
+      return false;
+    }
+  }
+  iteration_ = 0;
+  start_ns_ = now_ns();
+  return true;
+}
+
+uint64_t BenchmarkRunner::now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}
+#endif
+
 namespace cpm = cataplasm;
 #ifdef CATAPLASM_MAIN
+#ifdef CATAPLASM_TRACK_ALLOCATIONS
+//----[ Allocation tracking ]---------------------------------------------------
+static const bool cataplasm_allocations_tracked =
+    (cataplasm::allocations_tracked() = true);
+
+void *operator new(std::size_t size) { return cataplasm::new_tracked(size); }
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return ::operator new(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return ::operator new(size, std::nothrow);
+}
+void operator delete(void *ptr) noexcept { cataplasm::free_tracked(ptr); }
+void operator delete[](void *ptr) noexcept { cataplasm::free_tracked(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+#ifdef __cpp_sized_deallocation
+void operator delete(void *ptr, std::size_t) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+void operator delete[](void *ptr, std::size_t) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+#endif
+#ifdef __cpp_aligned_new
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return cataplasm::new_tracked(size, static_cast<std::size_t>(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return ::operator new(size, alignment);
+}
+void *operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+  try {
+    return ::operator new(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  return ::operator new(size, alignment, std::nothrow);
+}
+void operator delete(void *ptr, std::align_val_t) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+void operator delete(void *ptr, std::align_val_t,
+                     const std::nothrow_t &) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+void operator delete[](void *ptr, std::align_val_t,
+                       const std::nothrow_t &) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+#ifdef __cpp_sized_deallocation
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept {
+  cataplasm::free_tracked(ptr);
+}
+#endif
+#endif
+#endif
+
 int main(int argc, const char **argv) {
   cataplasm::ExprResult result = cataplasm::g_TestReferee().init(argc, argv);
   if (!result.status) {
@@ -0,0 +1,103 @@
+#!/usr/bin/env bash
+# Times compiling test files against the light interface of cataplasm.hpp
+# and against the whole header (CATAPLASM_FULL), to check the per-file
+# timings given in README.md.
+#
+#   ./compile_times.sh [N]
+#
+# Each file is compiled N times (default 10) with $CXX (default g++) and
+# $CXXFLAGS (default -std=c++11 -O0), and the mean time per file is printed.
+set -euo pipefail
+
+count=${1:-10}
+cxx=${CXX:-g++}
+flags=${CXXFLAGS:--std=c++11 -O0}
+root=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+cat >"$work/single.cpp" <<'EOF'
+#include "cataplasm.hpp"
+
+TEST_CASE("one test case", "fast") { VERIFY(1 + 1 == 2); }
+EOF
+
+cat >"$work/mixed.cpp" <<'EOF'
+#include "cataplasm.hpp"
+#include <string>
+#include <vector>
+
+struct Numbers {
+  Numbers() : values{1, 2, 3, 4} {}
+  std::vector<int> values;
+};
+
+TEST_CASE("assertions", "fast") {
+  const std::string name = "cataplasm";
+  ENSURE(name.size() == 9);
+  VERIFY(name[0] == 'c');
+  REJECT(name.empty());
+  VERIFY_EQ(name.substr(0, 4), "cata");
+  VERIFY_APPROX(0.1 + 0.2, 0.3, 1e-12, 0.0);
+  THROWS(std::vector<int>{}.at(1));
+  IF_VERIFY(name.back() == 'm') { PASS(name); }
+  SECTION("nested") {
+    FORBID(name == "catch");
+    VERIFY_LT(name.size(), 10u);
+  }
+}
+
+TEST_CASE("generators", "fast") {
+  const int base = GENERATE(1, 2, 3);
+  const int offset = GENERATE_RANGE(0, 4);
+  VERIFY(base + offset >= 1);
+  const std::vector<std::string> words{"a", "bb", "ccc"};
+  const std::string word = GENERATE_FROM(words);
+  VERIFY_GE(word.size(), 1u);
+}
+
+TEST_CASE_FIXTURE(Numbers, "fixture", "fast") {
+  ENSURE(values.size() == 4);
+  SECTION("sum") { VERIFY(values[0] + values[3] == 5); }
+  SECTION("all close") {
+    const std::vector<double> halves{0.5, 1.0, 1.5, 2.0};
+    VERIFY_ALL_CLOSE(values, halves, 1.0, 0.0);
+  }
+}
+
+TEST_CASE("benchmarks", "slow") {
+  std::vector<int> values(1000, 1);
+  BENCHMARK("sum") {
+    int sum = 0;
+    for (const int value : values) {
+      sum += value;
+    }
+    cataplasm::do_not_optimize(sum);
+  }
+}
+EOF
+
+printf '#define CATAPLASM_MAIN\n#include "cataplasm.hpp"\n' >"$work/main.cpp"
+
+# Print the mean time to compile a file, over `count` compilations.
+mean_time() {
+  local file=$1
+  shift
+  local total
+  total=$({
+    TIMEFORMAT=%R
+    time for ((i = 0; i < count; ++i)); do
+      $cxx $flags "$@" -I"$root" -c "$work/$file" -o "$work/out.o"
+    done
+  } 2>&1)
+  awk -v total="$total" -v count="$count" \
+    'BEGIN { printf "%8.2f s", total / count }'
+}
+
+echo "Mean of $count compilations with $cxx $flags:"
+printf '%-24s%10s%10s\n' "" "light" "full"
+for file in single.cpp mixed.cpp; do
+  printf '%-24s%10s%10s\n' "$file ($(wc -l <"$work/$file") lines)" \
+    "$(mean_time "$file")" "$(mean_time "$file" -DCATAPLASM_FULL)"
+done
+printf '%-24s%10s%10s\n' "main.cpp (MAIN)" "" "$(mean_time main.cpp)"